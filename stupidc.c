@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "stupidwm.h"
+
+// stupidc sends commands to a running stupidwm over its ipc socket. every argument is
+// one command, e.g.
+//
+//     stupidc "workspace 2" "send 3" "focus left"
+//
+// without arguments the commands are read from stdin, one per line. all commands are
+// sent as a single batch so the wm lays out the windows only once.
+//
+//     stupidc "subscribe snapshot"
+//
+// keeps the connection open and prints the wm's events as they happen.
+//
+//     stupidc --state
+//
+// prints the state from the wm's shared memory mirror without talking to the wm at all.
+
+static void
+die(const char* e)
+{
+    fprintf(stderr, "stupidc: %s\n", e);
+    exit(1);
+}
+
+// this has to match runtime_path in stupidwm.c
+static void
+runtime_path(char* buf, size_t size, const char* suffix)
+{
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    const char* display = getenv("DISPLAY");
+    if (dir == NULL || display == NULL) {
+        die("XDG_RUNTIME_DIR and DISPLAY need to be set");
+    }
+
+    snprintf(buf, size, "%s/stupidwm-%s.%s", dir, display, suffix);
+}
+
+static int
+print_state(void)
+{
+    char path[512];
+    State copy;
+    uint32_t s1, s2;
+
+    runtime_path(path, sizeof(path), "state");
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        die("failed to open the state mirror");
+    }
+    const State* st = mmap(NULL, sizeof(State), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (st == MAP_FAILED || st->magic != STATE_MAGIC || st->version != STATE_VERSION) {
+        die("state mirror is not usable");
+    }
+
+    do {
+        s1 = atomic_load_explicit(&st->seq, memory_order_acquire);
+        memcpy(&copy, (const void*)st, sizeof(copy));
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(&st->seq, memory_order_relaxed);
+    } while ((s1 & 1) || s1 != s2);
+
+    for (uint32_t i = 0; i < copy.nmonitors && i < STATE_MAX_MONITORS; ++i) {
+        StateMonitor* m = &copy.monitors[i];
+        fprintf(stdout, "monitor %u %dx%d+%d+%d workspace %d%s\n", i, m->width, m->height,
+            m->x, m->y, m->workspace, i == copy.selected_monitor ? " selected" : "");
+    }
+    for (uint32_t i = 0; i < copy.nclients && i < STATE_MAX_CLIENTS; ++i) {
+        StateClient* c = &copy.clients[i];
+        fprintf(stdout, "client 0x%x workspace %d %dx%d+%d+%d%s%s\n", c->window, c->workspace,
+            c->width, c->height, c->x, c->y, c->flags & StateFocused ? " focused" : "",
+            c->flags & StateVisible ? " visible" : "");
+    }
+    fprintf(stdout, "commits %llu\n", (unsigned long long)copy.commits);
+    return 0;
+}
+
+static void
+write_all(int fd, const char* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            die("failed to send commands");
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char buf[4096];
+    size_t len = 0;
+
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+        fprintf(stdout, "usage: stupidc [--state | command...]\n");
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--state") == 0) {
+        return print_state();
+    }
+
+    // build the whole batch first so that it arrives in one piece
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            int n = snprintf(buf + len, sizeof(buf) - len, "%s\n", argv[i]);
+            if (n < 0 || (size_t)n >= sizeof(buf) - len) {
+                die("too many commands");
+            }
+            len += n;
+        }
+    } else {
+        size_t n;
+        while ((n = fread(buf + len, 1, sizeof(buf) - len, stdin)) > 0) {
+            len += n;
+            if (len == sizeof(buf)) {
+                die("too many commands");
+            }
+        }
+        if (len > 0 && buf[len - 1] != '\n') {
+            buf[len++] = '\n';
+        }
+    }
+
+    runtime_path(addr.sun_path, sizeof(addr.sun_path), "sock");
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        die("failed to connect to stupidwm");
+    }
+
+    // a subscription lasts as long as the connection, only a plain batch of commands
+    // tells the wm that nothing else is coming.
+    bool subscribe = (len >= 9 && memcmp(buf, "subscribe", 9) == 0) || memmem(buf, len, "\nsubscribe", 10);
+    write_all(fd, buf, len);
+    if (!subscribe) {
+        shutdown(fd, SHUT_WR);
+    }
+
+    // print the replies and fail if any of the commands did
+    bool failed = false;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, n, stdout);
+        fflush(stdout);
+        if (memmem(buf, n, "error:", 6)) {
+            failed = true;
+        }
+    }
+
+    close(fd);
+    return failed ? 1 : 0;
+}
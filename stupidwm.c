@@ -1,21 +1,67 @@
+#define _GNU_SOURCE
 #include <X11/X.h>
+#ifndef NOBAR
 #include <X11/Xft/Xft.h>
+#endif
+#include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <X11/Xproto.h>
 #include <X11/cursorfont.h>
 #include <X11/extensions/Xrandr.h>
 #include <X11/extensions/Xrender.h>
+#include <X11/extensions/XShm.h>
 #include <X11/keysym.h>
 #include <signal.h>
+#include <spawn.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <poll.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <threads.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "stupidwm.h"
+
 #define WORKSPACE_COUNT 10
+#define SCRATCH_WS      WORKSPACE_COUNT // hidden workspace holding the scratchpad pool
+#define WORKSPACE_TOTAL (WORKSPACE_COUNT + 1)
+#define SCRATCH_POOL    2 // terminals kept ready for the scratchpad
+#define QUIT_TIMEOUT_MS 3000 // how long clients get to close before they're killed on quit
+#define KILL_TIMEOUT_MS 2000 // how long a client gets to close before it's killed
+#define KILL_PING       true // spare clients that still answer _NET_WM_PING at the deadline
+#define MAX_TIMERS      64 // initial timer slots, the table grows when they're used up
+#define MAX_LAUNCHES    32 // spawned processes we track until their first window maps
+#define LAUNCHER_MATCHES 32 // completions computed for the launcher
+#define INDEX_REBUILD_MS 200 // batch PATH changes, e.g. a package install, into one rebuild
+#define MAX_IPC_CLIENTS 16
+#define MAX_DOCKS       8 // panels and trays that reserve space at the screen edges
+#define TITLE_INTERVAL_MS 50 // fastest a title change is redrawn in the bar or sent over ipc
+#define GRAPH_WIDTH     30 // samples of history shown by each graph in the bar
+#define GRAPH_MAX_CPUS  8 // cores that get their own graph
+#define GRAPH_MAX       (GRAPH_MAX_CPUS + 2) // the cores, memory and network
+#define TEXT_CACHE_SIZE 64 // rendered text runs kept for redrawing the bar
+#define CONFIGURE_LIMIT 20 // ConfigureRequests answered per client and second, the rest are coalesced
+#define IPC_BUF_SIZE    4096 // longest batch of commands accepted in one go
+#define IPC_OUT_SIZE    16384 // events queued for a subscriber before they're coalesced
 
 // this is a generic argument to some functions we can use this to make defining keybinds a lot easier.
 // for example we want to give a workspace index or a command to a function.
@@ -31,27 +77,61 @@ typedef struct {
     const Arg arg;
 } Keybind;
 
+enum {
+    ProtoDelete = 1 << 0, // WM_DELETE_WINDOW
+    ProtoPing = 1 << 1, // _NET_WM_PING
+};
+
 typedef struct Client {
     struct Client* next;
     struct Client* prev;
     Window window;
+    unsigned int protocols; // WM_PROTOCOLS the client advertised when it was managed
+    bool alive; // answered a ping since it was asked to close
+    bool has_name; // name has been read from the window
+    char name[256];
+    int x, y, width, height; // geometry we last gave the window
+    int wm_state; // WM_STATE we last wrote, 0 before the first write
+    bool fullscreen; // asked for _NET_WM_STATE_FULLSCREEN
+    bool floating; // dialogs and transients float above the tiled clients
+    int float_x, float_y, float_width, float_height; // where a floating client goes back to after fullscreen
+    Window transient_for; // parent of a transient window
+    long long configure_start; // start of the current rate limiting second
+    int configures; // ConfigureRequests answered since configure_start
+    bool configure_deferred; // a reply is owed once the rate limit allows it
+    bool title_pending; // a title event is owed over ipc
+    long long title_sent; // when the last title event was sent
 } Client;
 
 typedef struct Workspace {
     Client* first;
     Client* curr;
+    bool state_dirty; // clients' WM_STATE needs to be checked in the next commit
+    Client* fullscreen; // covers the monitor, the other clients aren't laid out meanwhile
 } Workspace;
 
 typedef struct Monitor {
     int x, y;
     int width, height;
     int screen;
+#ifndef NOBAR
     Window bar_window; // status bar window where the bar will be rendered
+    Pixmap buffer; // the bar is drawn here and copied to bar_window
     GC graphics_ctx;   // graphics context for drawing the bar
     XftDraw* xft;
+    bool bar_hidden; // bar is unmapped while a fullscreen client is shown
+    int tags_width; // the title is drawn right of the tags
+    char title[256]; // title currently in the bar
+    int title_width; // width the title takes up in the bar
+    bool title_pending; // a title change is waiting for its timer
+    long long title_drawn; // when the title was last redrawn because of a change
+#endif
     int curr_workspace;
     struct Monitor* next;
     bool primary;
+    bool dirty; // needs to be laid out in the next commit
+    int wx, wy, ww, wh; // work area left over by the bar and docks, clients are tiled in it
+    int published_ws; // workspace last announced to ipc subscribers
 } Monitor;
 
 static void
@@ -62,26 +142,116 @@ die(const char* e)
 }
 
 #define SEL_MONITOR_WS (workspaces[selected_monitor->curr_workspace])
+#define MAX(A, B)       ((A) > (B) ? (A) : (B))
+#define MIN(A, B)       ((A) < (B) ? (A) : (B))
 
 static Display* disp;
 static bool quit_flag;
+static int shutdown_pending; // clients we're still waiting on to close while quitting
+static int ipc_fd = -1; // listening unix socket for stupidc and scripts
+static bool focus_dirty; // focus and borders need to be updated in the next commit
+static bool bars_dirty; // bars need to be redrawn in the next commit
+static unsigned long long event_counts[LASTEvent];
+static unsigned long long commit_count;
 static int main_screen; // this is consistent between monitors
 static Window rootwin;
-static Workspace workspaces[WORKSPACE_COUNT]; // this is global between monitors
+static Workspace workspaces[WORKSPACE_TOTAL]; // this is global between monitors
 static Cursor cursor;
 static unsigned int focus_color;
 static unsigned int unfocus_color;
+#ifndef NOBAR
 static XftFont* font;
-static XftDraw* xft;
+static XftDraw* xft; // renders new text runs into their pixmaps
 static XftColor xft_focus_color;
 static XftColor xft_unfocus_color;
+#endif
+static int (*xerrorxlib)(Display*, XErrorEvent*);
+static char* wm_path; // argv[0], used to exec ourselves on restart
+static int signal_fd; // SIGCHLD is delivered through this fd instead of a handler
+static Client* scratch_active; // scratchpad terminal taken from the pool, if any
+static bool scratch_visible;
+extern char** environ;
+
+// atoms are interned once at startup in a single round trip.
+enum {
+    WMProtocols,
+    WMDelete,
+    NetWMPing,
+    NetWMPid,
+    NetStartupId,
+    NetWMName,
+    NetSupported,
+    NetSupportingWMCheck,
+    NetClientList,
+    NetActiveWindow,
+    NetCurrentDesktop,
+    NetNumberOfDesktops,
+    NetWMState,
+    NetWMStateHidden,
+    NetWMStateFullscreen,
+    NetWMWindowType,
+    NetWMWindowTypeDialog,
+    NetWMWindowTypeUtility,
+    NetWMWindowTypeSplash,
+    NetWMWindowTypeDock,
+    NetWMStrut,
+    NetWMStrutPartial,
+    WMState,
+    UTF8String,
+    StupidWorkspace, // workspace hint stored on each managed window
+    AtomLast,
+};
+static Atom atoms[AtomLast];
+static char* atom_names[AtomLast] = {
+    [WMProtocols] = "WM_PROTOCOLS",
+    [WMDelete] = "WM_DELETE_WINDOW",
+    [NetWMPing] = "_NET_WM_PING",
+    [NetWMPid] = "_NET_WM_PID",
+    [NetStartupId] = "_NET_STARTUP_ID",
+    [NetWMName] = "_NET_WM_NAME",
+    [NetSupported] = "_NET_SUPPORTED",
+    [NetSupportingWMCheck] = "_NET_SUPPORTING_WM_CHECK",
+    [NetClientList] = "_NET_CLIENT_LIST",
+    [NetActiveWindow] = "_NET_ACTIVE_WINDOW",
+    [NetCurrentDesktop] = "_NET_CURRENT_DESKTOP",
+    [NetNumberOfDesktops] = "_NET_NUMBER_OF_DESKTOPS",
+    [NetWMState] = "_NET_WM_STATE",
+    [NetWMStateHidden] = "_NET_WM_STATE_HIDDEN",
+    [NetWMStateFullscreen] = "_NET_WM_STATE_FULLSCREEN",
+    [NetWMWindowType] = "_NET_WM_WINDOW_TYPE",
+    [NetWMWindowTypeDialog] = "_NET_WM_WINDOW_TYPE_DIALOG",
+    [NetWMWindowTypeUtility] = "_NET_WM_WINDOW_TYPE_UTILITY",
+    [NetWMWindowTypeSplash] = "_NET_WM_WINDOW_TYPE_SPLASH",
+    [NetWMWindowTypeDock] = "_NET_WM_WINDOW_TYPE_DOCK",
+    [NetWMStrut] = "_NET_WM_STRUT",
+    [NetWMStrutPartial] = "_NET_WM_STRUT_PARTIAL",
+    [WMState] = "WM_STATE",
+    [UTF8String] = "UTF8_STRING",
+    [StupidWorkspace] = "_STUPIDWM_WORKSPACE",
+};
 
 static void spawn(const Arg arg);
 static void kill_curr();
-static void add_window(Window w);
 static void client_to_workspace(const Arg arg);
 static void change_workspace(const Arg arg);
 static void quit();
+static void restart();
+static void launcher_open();
+static void scratch_toggle();
+static void ipc_accept(void);
+static int ipc_pollfds(struct pollfd* fds);
+static void ipc_handle(struct pollfd* fds, int n);
+static void ipc_event(const char* fmt, ...);
+static void ipc_publish(void);
+static void publish_state(void);
+static void ewmh_publish(void);
+#ifndef NOBAR
+static bool draw_launcher(Monitor* m);
+static bool launcher_shown(Monitor* m);
+static int status_x(Monitor* m, int segment);
+static int graphs_x(Monitor* m);
+static const char* client_name(Client* cl);
+#endif
 
 static void move_left();
 static void move_up();
@@ -91,8 +261,14 @@ static void move_right();
 static Monitor* monitors;
 static Monitor* selected_monitor;
 
+// building with -DNOBAR leaves out the bar and with it Xft, for setups that run an
+// external bar. the launcher is replaced by dmenu and tiling gets the whole monitor.
+#ifndef NOBAR
 static int bar_height = 20;
 static const char* tags[] = { "1", "2", "3", "4", "5", "6", "7", "8", "9", "0" };
+#else
+static int bar_height = 0;
+#endif
 
 // x events
 static void configurenotify(XEvent* e);
@@ -102,6 +278,8 @@ static void destroynotify(XEvent* e);
 static void maprequest(XEvent* e);
 static void enternotify(XEvent* e);
 static void expose(XEvent* e);
+static void clientmessage(XEvent* e);
+static void propertynotify(XEvent* e);
 
 #define FOCUS   "#f9f5d7"
 #define UNFOCUS "#282828"
@@ -117,10 +295,13 @@ const char* term_cmd[] = { "kitty", NULL };
 #define MOVEMENT(K, F) { MOD, K, F, { NULL } },
 
 static Keybind keys[] = {
-    { MOD | ShiftMask, XK_p, spawn, { .command = dmenu_cmd } },
+    { MOD | ShiftMask, XK_p, launcher_open, { NULL } },
+    { MOD | ControlMask, XK_p, spawn, { .command = dmenu_cmd } },
+    { MOD, XK_s, scratch_toggle, { NULL } },
     { MOD | ShiftMask, XK_q, kill_curr, { NULL } },
     { MOD | ShiftMask, XK_Return, spawn, { .command = term_cmd } },
     { MOD | ShiftMask, XK_e, quit, { NULL } },
+    { MOD | ShiftMask, XK_r, restart, { NULL } },
     DESKTOPCHANGE(XK_1, 0)
         DESKTOPCHANGE(XK_2, 1)
             DESKTOPCHANGE(XK_3, 2)
@@ -137,7 +318,9 @@ static Keybind keys[] = {
                                                         MOVEMENT(XK_j, move_down)
 };
 
+#ifndef NOBAR
 #define FONT "Iosevka Comfy:size=13"
+#endif
 
 static void (*events[LASTEvent])(XEvent* e) = {
     [KeyPress] = keypress,
@@ -147,15 +330,81 @@ static void (*events[LASTEvent])(XEvent* e) = {
     [ConfigureRequest] = configurerequest,
     [EnterNotify] = enternotify,
     [Expose] = expose,
+    [ClientMessage] = clientmessage,
+    [PropertyNotify] = propertynotify,
 };
 
+#ifndef NOBAR
+// matching the font through fontconfig is the slowest part of our startup, so it's done on
+// a thread that only touches fontconfig while we already manage windows. the main loop
+// opens the matched font once font_fd signals and the bars are drawn without text until
+// then.
+static int font_fd = -1;
+static thrd_t font_thread;
+static FcPattern* font_match;
+
+static int
+match_font(void* arg)
+{
+    FcPattern* pattern = arg;
+    if (pattern) {
+        FcResult result;
+        FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+        FcDefaultSubstitute(pattern);
+        font_match = FcFontMatch(NULL, pattern, &result);
+        FcPatternDestroy(pattern);
+    }
+
+    uint64_t done = 1;
+    if (write(font_fd, &done, sizeof(done)) < 0) {
+        return 1;
+    }
+    return 0;
+}
+
 static void
-setup_bar(void)
+join_font_thread(void)
+{
+    uint64_t done;
+    if (read(font_fd, &done, sizeof(done)) < 0 && errno != EAGAIN) {
+        die("failed to read font_fd");
+    }
+    thrd_join(font_thread, NULL);
+    close(font_fd);
+    font_fd = -1;
+}
+
+static void
+handle_font(void)
 {
-    font = XftFontOpenName(disp, main_screen, FONT);
+    join_font_thread();
+    if (font_match) {
+        font = XftFontOpenPattern(disp, font_match);
+        if (!font) {
+            FcPatternDestroy(font_match);
+        }
+        font_match = NULL;
+    }
     if (!font) {
         die("failed to load font");
     }
+    bars_dirty = true;
+}
+
+static void
+setup_bar(void)
+{
+    // the dpi, antialiasing and hinting from the x resources are filled in here because
+    // that takes xlib, the worker only runs fontconfig.
+    FcPattern* pattern = FcNameParse((const FcChar8*)FONT);
+    if (pattern) {
+        XftDefaultSubstitute(disp, main_screen, pattern);
+    }
+
+    font_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (font_fd < 0 || thrd_create(&font_thread, match_font, pattern) != thrd_success) {
+        die("failed to start loading the font");
+    }
 
     // xft = XftDrawCreate(disp, bar_window, XDefaultVisual(disp, main_screen), XDefaultColormap(disp, main_screen));
     // if (!xft) {
@@ -170,730 +419,4203 @@ setup_bar(void)
         UNFOCUS, &xft_unfocus_color);
 }
 
+// text drawn into the bar is rendered once into a pixmap, together with its background,
+// and kept in a small lru cache. redrawing the bar then only composites the cached runs
+// instead of laying out and rasterizing the glyphs again.
+typedef struct {
+    char text[128];
+    const XftFont* font;
+    const XftColor* fg;
+    unsigned long bg;
+    int width;
+    Pixmap pixmap;
+    Picture picture;
+    unsigned long long used; // 0 while the slot is free
+} TextRun;
+
+static TextRun text_cache[TEXT_CACHE_SIZE];
+static unsigned long long text_clock;
+
 static void
-draw_monitor_bar(Monitor* m)
+free_text_run(TextRun* run)
 {
-    XSetForeground(disp, m->graphics_ctx, unfocus_color);
-    XFillRectangle(disp, m->bar_window, m->graphics_ctx, 0, 0, m->width, bar_height);
+    if (run->used) {
+        XRenderFreePicture(disp, run->picture);
+        XFreePixmap(disp, run->pixmap);
+        run->used = 0;
+    }
+}
 
-    int x = 0;
-    int tag_width = 20;
+static void
+render_text_run(Monitor* m, TextRun* run, const char* text, size_t len, const XftColor* fg, unsigned long bg)
+{
     XGlyphInfo extents;
 
-    for (int i = 0; i < WORKSPACE_COUNT; i++) {
-        XftTextExtentsUtf8(disp, font, (XftChar8*)tags[i], strlen(tags[i]), &extents);
-        tag_width = extents.xOff + 10;
+    free_text_run(run);
+    XftTextExtentsUtf8(disp, font, (XftChar8*)text, len, &extents);
+    run->width = extents.xOff + 10;
+    run->pixmap = XCreatePixmap(disp, rootwin, run->width, bar_height, DefaultDepth(disp, main_screen));
 
-        XSetForeground(disp, m->graphics_ctx, i == m->curr_workspace ? focus_color : unfocus_color);
-        XFillRectangle(disp, m->bar_window, m->graphics_ctx, x, 0, tag_width, bar_height);
-
-        XftDrawStringUtf8(m->xft, i == m->curr_workspace ? &xft_unfocus_color : &xft_focus_color,
-            font, x + 5, bar_height - (bar_height - font->ascent) / 2,
-            (XftChar8*)tags[i], strlen(tags[i]));
-
-        x += tag_width;
+    XSetForeground(disp, m->graphics_ctx, bg);
+    XFillRectangle(disp, run->pixmap, m->graphics_ctx, 0, 0, run->width, bar_height);
+    if (xft == NULL) {
+        xft = XftDrawCreate(disp, run->pixmap, DefaultVisual(disp, main_screen), DefaultColormap(disp, main_screen));
+    } else {
+        XftDrawChange(xft, run->pixmap);
     }
+    XftDrawStringUtf8(xft, fg, font, 5, bar_height - (bar_height - font->ascent) / 2, (XftChar8*)text, len);
+    run->picture = XRenderCreatePicture(disp, run->pixmap,
+        XRenderFindVisualFormat(disp, DefaultVisual(disp, main_screen)), 0, NULL);
+
+    memcpy(run->text, text, len + 1);
+    run->font = font;
+    run->fg = fg;
+    run->bg = bg;
 }
 
-static void
-update_curr(void)
+// draw_text draws the text with 5px of padding on both sides over a box filled with bg and
+// returns the width of the box.
+static int
+draw_text(Monitor* m, int x, const char* text, const XftColor* fg, unsigned long bg)
 {
-    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
-        if (SEL_MONITOR_WS.curr == cl) {
-            XSetWindowBorderWidth(disp, cl->window, 5);
-            XSetWindowBorder(disp, cl->window, focus_color);
-            XSetInputFocus(disp, cl->window, RevertToParent, CurrentTime);
-            XRaiseWindow(disp, cl->window);
-        } else {
-            XSetWindowBorder(disp, cl->window, unfocus_color);
+    size_t len = strlen(text);
+    TextRun* run = NULL;
+    TextRun* victim = &text_cache[0];
+
+    if (len >= sizeof(run->text)) {
+        // too long to be worth keeping, e.g. a huge title
+        XGlyphInfo extents;
+        XftTextExtentsUtf8(disp, font, (XftChar8*)text, len, &extents);
+        XSetForeground(disp, m->graphics_ctx, bg);
+        XFillRectangle(disp, m->buffer, m->graphics_ctx, x, 0, extents.xOff + 10, bar_height);
+        XftDrawStringUtf8(m->xft, fg, font, x + 5, bar_height - (bar_height - font->ascent) / 2,
+            (XftChar8*)text, len);
+        return extents.xOff + 10;
+    }
+
+    for (int i = 0; i < TEXT_CACHE_SIZE && run == NULL; ++i) {
+        TextRun* r = &text_cache[i];
+        if (r->used && r->font == font && r->fg == fg && r->bg == bg && strcmp(r->text, text) == 0) {
+            run = r;
+        } else if (r->used < victim->used) {
+            victim = r;
         }
     }
+    if (run == NULL) {
+        run = victim;
+        render_text_run(m, run, text, len, fg, bg);
+    }
+    run->used = ++text_clock;
+
+    XRenderComposite(disp, PictOpSrc, run->picture, None, XftDrawPicture(m->xft),
+        0, 0, 0, 0, x, 0, run->width, bar_height);
+    return run->width;
 }
 
-static void
-move_left(void)
-{
-    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
-        return;
+// the status segments at the right end of the bar are collected by a thread that wakes on
+// every whole second, reads /proc and /sys into fixed buffers and formats the segments'
+// text. the text is published through two buffers, the collector always writes the one
+// that isn't current and status_seq says which one is, the main loop copies it out once
+// status_fd signals and redraws only the segments whose text changed.
+enum {
+    StatusCpu,
+    StatusMem,
+    StatusBattery,
+    StatusClock,
+    StatusLast,
+};
 
-    SEL_MONITOR_WS.curr = SEL_MONITOR_WS.first;
-    update_curr();
+typedef struct {
+    char text[StatusLast][32];
+    uint8_t graph[GRAPH_MAX]; // newest sample of each graph in percent
+    int ngraphs;
+} StatusSample;
+
+// what the collector remembers between samples to turn counters into rates
+typedef struct {
+    unsigned long long busy[GRAPH_MAX_CPUS + 1], total[GRAPH_MAX_CPUS + 1]; // all cpus first
+    unsigned long long net;
+} Collector;
+
+static StatusSample status_buf[2];
+static _Atomic unsigned int status_seq; // status_buf[status_seq & 1] is current
+static int status_fd = -1;
+static thrd_t status_thread;
+static char status_text[StatusLast][32]; // text currently in the bars
+static int status_slot[StatusLast]; // width of each segment, only ever grows
+
+static size_t
+read_file(const char* path, char* buf, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    n = n < 0 ? 0 : n;
+    buf[n] = '\0';
+    return n;
 }
 
-static void
-move_right(void)
+static const char*
+parse_number(const char* p, unsigned long long* value)
 {
-    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
-        return;
+    *value = 0;
+    while (*p == ' ' || *p == '\t') {
+        ++p;
+    }
+    for (; *p >= '0' && *p <= '9'; ++p) {
+        *value = *value * 10 + (*p - '0');
+    }
+    return p;
+}
 
-    // If we're on master, move to the first stacked window
-    if (SEL_MONITOR_WS.curr == SEL_MONITOR_WS.first && SEL_MONITOR_WS.first->next) {
-        SEL_MONITOR_WS.curr = SEL_MONITOR_WS.first->next;
+static unsigned long long
+meminfo_field(const char* buf, const char* field)
+{
+    unsigned long long value = 0;
+    const char* p = strstr(buf, field);
+    if (p) {
+        parse_number(p + strlen(field), &value);
     }
-    update_curr();
+    return value;
+}
+
+// network traffic is graphed on a log scale, the top of the graph is 1GiB/s
+static uint8_t
+net_percent(unsigned long long bytes)
+{
+    int bits = bytes ? 64 - __builtin_clzll(bytes) : 0;
+    return MIN(bits * 100 / 30, 100);
 }
 
 static void
-move_up(void)
+collect(StatusSample* st, Collector* c)
 {
-    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
-        return;
+    char buf[4096];
+    unsigned long long value;
+    int ncpus = 0;
+
+    // the first line of /proc/stat sums up all cpus and is followed by one line per cpu.
+    // idle and iowait are the 4th and 5th column.
+    read_file("/proc/stat", buf, sizeof(buf));
+    for (const char* p = buf; strncmp(p, "cpu", 3) == 0 && ncpus <= GRAPH_MAX_CPUS; ++ncpus) {
+        unsigned long long busy = 0, total = 0;
+        p += 3;
+        if (*p >= '0' && *p <= '9') {
+            p = parse_number(p, &value); // the cpu's number
+        }
+        for (int i = 0; i < 8; ++i) {
+            p = parse_number(p, &value);
+            total += value;
+            busy += (i == 3 || i == 4) ? 0 : value;
+        }
 
-    // If we're not on master and have a previous window
-    if (SEL_MONITOR_WS.curr != SEL_MONITOR_WS.first && SEL_MONITOR_WS.curr->prev) {
-        SEL_MONITOR_WS.curr = SEL_MONITOR_WS.curr->prev;
+        unsigned long long dt = total - c->total[ncpus];
+        uint8_t percent = dt ? (busy - c->busy[ncpus]) * 100 / dt : 0;
+        c->busy[ncpus] = busy;
+        c->total[ncpus] = total;
+        if (ncpus == 0) {
+            snprintf(st->text[StatusCpu], sizeof(st->text[StatusCpu]), "cpu %u%%", percent);
+        } else {
+            st->graph[ncpus - 1] = percent;
+        }
+
+        p = strchr(p, '\n');
+        if (p == NULL) {
+            break;
+        }
+        ++p;
+    }
+    st->ngraphs = ncpus > 0 ? ncpus - 1 : 0;
+
+    read_file("/proc/meminfo", buf, sizeof(buf));
+    unsigned long long total = meminfo_field(buf, "MemTotal:");
+    unsigned long long used = total - meminfo_field(buf, "MemAvailable:");
+    snprintf(st->text[StatusMem], sizeof(st->text[StatusMem]), "mem %.1fG", used / 1048576.0);
+    st->graph[st->ngraphs++] = total ? used * 100 / total : 0;
+
+    // received and sent bytes of every interface but loopback, after the two header lines
+    unsigned long long net = 0;
+    read_file("/proc/net/dev", buf, sizeof(buf));
+    const char* line = strchr(buf, '\n');
+    line = line ? strchr(line + 1, '\n') : NULL;
+    while (line && *++line) {
+        const char* p = strchr(line, ':');
+        if (p == NULL) {
+            break;
+        }
+        bool loopback = strncmp(line + strspn(line, " "), "lo:", 3) == 0;
+        ++p;
+        for (int i = 0; i < 9; ++i) {
+            p = parse_number(p, &value);
+            if (!loopback && (i == 0 || i == 8)) {
+                net += value;
+            }
+        }
+        line = strchr(p, '\n');
     }
-    update_curr();
+    st->graph[st->ngraphs++] = c->net ? net_percent(net - c->net) : 0;
+    c->net = net;
+
+    st->text[StatusBattery][0] = '\0';
+    if (read_file("/sys/class/power_supply/BAT0/capacity", buf, sizeof(buf))) {
+        parse_number(buf, &value);
+        snprintf(st->text[StatusBattery], sizeof(st->text[StatusBattery]), "bat %llu%%", value);
+    }
+
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(st->text[StatusClock], sizeof(st->text[StatusClock]), "%a %d %b %H:%M", &tm);
 }
 
-static void
-move_down(void)
+static int
+collect_status(void* _unused)
 {
-    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
-        return;
+    (void)_unused;
+    Collector c = { 0 };
+    uint64_t one = 1;
+
+    for (;;) {
+        unsigned int seq = atomic_load_explicit(&status_seq, memory_order_relaxed);
+        collect(&status_buf[(seq + 1) & 1], &c);
+        atomic_store_explicit(&status_seq, seq + 1, memory_order_release);
+        if (write(status_fd, &one, sizeof(one)) < 0) {
+            return 1;
+        }
 
-    // If we have a next window
-    if (SEL_MONITOR_WS.curr->next) {
-        SEL_MONITOR_WS.curr = SEL_MONITOR_WS.curr->next;
+        // sleep until the next whole second so that the clock turns over in time and we
+        // don't wake up more than once a second
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        ts.tv_nsec = 0;
+        while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
     }
-    update_curr();
+    return 0;
 }
 
+// the thread is never joined, it only dies with the process
 static void
-cleanup_font(void)
+setup_status(void)
 {
-    for (Monitor* m = monitors; m; m = m->next) {
-        if (m->xft) {
-            XftDrawDestroy(m->xft);
-            m->xft = NULL;
-        }
+    status_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (status_fd < 0 || thrd_create(&status_thread, collect_status, NULL) != thrd_success) {
+        fprintf(stdout, "stupidwm: status segments disabled\n");
+        return;
     }
+    thrd_detach(status_thread);
+}
 
-    if (font) {
-        XftFontClose(disp, font);
-        font = NULL;
-    }
+// the graphs left of the status segments are drawn into a single image that is shared
+// with the server through MIT-SHM where possible, so putting it into the bars doesn't send
+// its pixels through the socket. each sample scrolls the image by a column and only the
+// newest column is drawn. the samples are also kept in rings to draw the image from
+// scratch. without MIT-SHM, e.g. on a remote display, the image is sent as usual.
+static uint8_t graph_samples[GRAPH_MAX][GRAPH_WIDTH];
+static int graph_head; // next column to write in the rings
+static int ngraphs;
+static XImage* graph_image;
+static XShmSegmentInfo graph_shm = { .shmid = -1 };
 
-    XftColorFree(disp, DefaultVisual(disp, main_screen),
-        DefaultColormap(disp, main_screen), &xft_focus_color);
-    XftColorFree(disp, DefaultVisual(disp, main_screen),
-        DefaultColormap(disp, main_screen), &xft_unfocus_color);
-}
+#define GRAPH_STRIDE (GRAPH_WIDTH + 4) // a graph and its padding
 
 static void
-draw_bar(void)
+draw_graph_column(int graph, int column, uint8_t percent)
 {
-    for (Monitor* m = monitors; m; m = m->next) {
-        draw_monitor_bar(m);
+    const int height = percent * (bar_height - 4) / 100;
+    const int x = graph * GRAPH_STRIDE + 2 + column;
+
+    for (int y = 0; y < bar_height; ++y) {
+        bool filled = y < bar_height - 2 && y >= bar_height - 2 - height;
+        XPutPixel(graph_image, x, y, filled ? focus_color : unfocus_color);
     }
 }
 
 static void
-expose(XEvent* e)
+destroy_graph_image(void)
 {
-    XExposeEvent* ev = &e->xexpose;
-    for (Monitor* m = monitors; m; m = m->next) {
-        if (ev->window == m->bar_window && ev->count == 0) {
-            draw_monitor_bar(m);
-            break;
-        }
+    if (graph_image == NULL) {
+        return;
     }
+    if (graph_shm.shmid >= 0) {
+        XShmDetach(disp, &graph_shm);
+        shmdt(graph_shm.shmaddr);
+        graph_shm.shmid = -1;
+        graph_image->data = NULL;
+    }
+    XDestroyImage(graph_image);
+    graph_image = NULL;
 }
 
 static void
-tile_screen(void)
+create_graph_image(void)
 {
-    // there are three different cases
-    // 1. there are no windows -> do nothing
-    // 2. there is a single window -> add space around the only window
-    // 3. there are multiple windows -> count the amount of windows and divide the space evenly
-    const int space = 10;
-    const int start_y = bar_height + space;
-    if (SEL_MONITOR_WS.first != NULL && SEL_MONITOR_WS.first->next == NULL) {
-        // special case there is only a single window
-        XMoveResizeWindow(disp, SEL_MONITOR_WS.first->window, space, start_y, selected_monitor->width - 3 * space, selected_monitor->height - 3 * space);
-    } else if (SEL_MONITOR_WS.first != NULL && SEL_MONITOR_WS.first->next != NULL) { // multiple windows
-        const int master_size = 0.55 * selected_monitor->width;
-        XMoveResizeWindow(disp, SEL_MONITOR_WS.first->window, space, start_y, master_size, selected_monitor->height - 2 * space);
-        int x = master_size + 3 * space;
-        int y = start_y;
-        int tile_height = selected_monitor->width - master_size - 5 * space;
-        int num_windows = 0;
+    Visual* visual = DefaultVisual(disp, main_screen);
+    int depth = DefaultDepth(disp, main_screen);
+    int width = ngraphs * GRAPH_STRIDE;
 
-        for (Client* cl = SEL_MONITOR_WS.first->next; cl != NULL; cl = cl->next) {
-            ++num_windows;
+    destroy_graph_image();
+    if (XShmQueryExtension(disp)) {
+        graph_image = XShmCreateImage(disp, visual, depth, ZPixmap, NULL, &graph_shm, width, bar_height);
+    }
+    if (graph_image) {
+        graph_shm.shmid = shmget(IPC_PRIVATE, graph_image->bytes_per_line * bar_height, IPC_CREAT | 0600);
+        graph_shm.shmaddr = graph_image->data = graph_shm.shmid >= 0 ? shmat(graph_shm.shmid, NULL, 0) : (void*)-1;
+        graph_shm.readOnly = True;
+        if (graph_shm.shmaddr != (void*)-1 && XShmAttach(disp, &graph_shm)) {
+            // the segment goes away with the last of us and the server detaching
+            XSync(disp, False);
+            shmctl(graph_shm.shmid, IPC_RMID, NULL);
+        } else {
+            if (graph_shm.shmid >= 0) {
+                if (graph_shm.shmaddr != (void*)-1) {
+                    shmdt(graph_shm.shmaddr);
+                }
+                shmctl(graph_shm.shmid, IPC_RMID, NULL);
+                graph_shm.shmid = -1;
+            }
+            graph_image->data = NULL;
+            XDestroyImage(graph_image);
+            graph_image = NULL;
+        }
+    }
+    if (graph_image == NULL) {
+        graph_image = XCreateImage(disp, visual, depth, ZPixmap, 0, NULL, width, bar_height, 32, 0);
+        graph_image->data = calloc(graph_image->bytes_per_line, bar_height);
+        if (graph_image->data == NULL) {
+            die("failed calloc");
         }
+    }
 
-        for (Client* cl = SEL_MONITOR_WS.first->next; cl != NULL; cl = cl->next) {
-            XMoveResizeWindow(disp, cl->window, x, y, tile_height, (selected_monitor->height / num_windows) - 2 * space);
-            y += selected_monitor->height / num_windows;
+    for (int x = 0; x < width; ++x) {
+        for (int y = 0; y < bar_height; ++y) {
+            XPutPixel(graph_image, x, y, unfocus_color);
+        }
+    }
+    for (int g = 0; g < ngraphs; ++g) {
+        for (int i = 0; i < GRAPH_WIDTH; ++i) {
+            draw_graph_column(g, i, graph_samples[g][(graph_head + i) % GRAPH_WIDTH]);
         }
     }
 }
 
 static void
-tile_monitor(Monitor* m)
+push_graph_samples(const StatusSample* st)
 {
-    // there are three different cases
-    // 1. there are no windows -> do nothing
-    // 2. there is a single window -> add space around the only window
-    // 3. there are multiple windows -> count the amount of windows and divide the space evenly
-    const int space = 10;
-    const int start_y = bar_height + space;
-    Client* master = workspaces[m->curr_workspace].first;
-    if (master != NULL && master->next == NULL) {
-        XMoveResizeWindow(disp, SEL_MONITOR_WS.first->window, space, start_y, selected_monitor->width - 3 * space, selected_monitor->height - 3 * space);
-    } else if (master != NULL && master->next != NULL) {
-        const int master_size = 0.55 * m->width;
-        XMoveResizeWindow(disp, master->window, m->x + space, m->y + start_y, master_size, m->height - 2 * space);
-        int x = m->x + master_size + 3 * space;
-        int y = m->y + start_y;
-        int tile_width = m->width - master_size - 5 * space;
-        int nwindows = 0;
+    if (st->ngraphs != ngraphs) {
+        ngraphs = st->ngraphs;
+        for (int g = 0; g < ngraphs; ++g) {
+            graph_samples[g][graph_head] = st->graph[g];
+        }
+        graph_head = (graph_head + 1) % GRAPH_WIDTH;
+        create_graph_image();
+        bars_dirty = true;
+        return;
+    }
 
-        for (Client* cl = master->next; cl != NULL; cl = cl->next)
-            ++nwindows;
+    const int bpp = graph_image->bits_per_pixel / 8;
+    for (int g = 0; g < ngraphs; ++g) {
+        graph_samples[g][graph_head] = st->graph[g];
 
-        for (Client* cl = master->next; cl != NULL; cl = cl->next) {
-            XMoveResizeWindow(disp, cl->window, x, y, tile_width, (selected_monitor->height / nwindows) - 2 * space);
-            y += selected_monitor->height / nwindows;
+        // scroll the graph a column to the left and add the new sample on the right
+        for (int y = 0; y < bar_height; ++y) {
+            char* row = graph_image->data + y * graph_image->bytes_per_line + (g * GRAPH_STRIDE + 2) * bpp;
+            memmove(row, row + bpp, (GRAPH_WIDTH - 1) * bpp);
         }
+        draw_graph_column(g, GRAPH_WIDTH - 1, st->graph[g]);
     }
+    graph_head = (graph_head + 1) % GRAPH_WIDTH;
 }
 
-static Monitor*
-monitor_from_window(Window w)
+static void
+render_graphs(Monitor* m)
 {
-    if (w == rootwin) {
-        return selected_monitor;
+    if (graph_image == NULL) {
+        return;
     }
-
-    int x, y;
-    Window child;
-    XTranslateCoordinates(disp, w, rootwin, 0, 0, &x, &y, &child);
-
-    for (Monitor* m = monitors; m; m = m->next) {
-        if (x >= m->x && x < m->x + m->width &&
-            y >= m->y && y < m->y + m->height)
-            return m;
+    if (graph_shm.shmid >= 0) {
+        XShmPutImage(disp, m->buffer, m->graphics_ctx, graph_image, 0, 0, graphs_x(m), 0,
+            graph_image->width, bar_height, False);
+    } else {
+        XPutImage(disp, m->buffer, m->graphics_ctx, graph_image, 0, 0, graphs_x(m), 0,
+            graph_image->width, bar_height);
     }
-
-    return selected_monitor;
 }
 
-static void
-focus_monitor(Monitor* m)
+static int
+graphs_x(Monitor* m)
 {
-    if (m && m != selected_monitor) {
-        Monitor* old = selected_monitor;
-        selected_monitor = m;
-        update_curr();
-        draw_monitor_bar(old);
-        draw_monitor_bar(m);
-    }
+    return status_x(m, 0) - ngraphs * GRAPH_STRIDE;
 }
 
-static void
-focus_next_monitor()
+static int
+status_x(Monitor* m, int segment)
 {
-    if (!selected_monitor || !selected_monitor->next) {
-        return;
+    int x = m->width;
+    for (int i = StatusLast - 1; i >= segment; --i) {
+        x -= status_slot[i];
     }
-
-    focus_monitor(selected_monitor->next);
+    return x;
 }
 
 static void
-save_state(int idx)
+render_status(Monitor* m, int segment)
 {
-    workspaces[idx].curr = SEL_MONITOR_WS.curr;
-    workspaces[idx].first = SEL_MONITOR_WS.first;
+    const char* text = status_text[segment];
+    int x = status_x(m, segment);
+
+    XSetForeground(disp, m->graphics_ctx, unfocus_color);
+    XFillRectangle(disp, m->buffer, m->graphics_ctx, x, 0, status_slot[segment], bar_height);
+    XftDrawStringUtf8(m->xft, &xft_focus_color, font, x + 5,
+        bar_height - (bar_height - font->ascent) / 2, (XftChar8*)text, strlen(text));
 }
 
-static void
-update_global(int idx)
+// update_slot makes room for the segment's text and tells if the slot had to grow.
+static bool
+update_slot(int segment)
 {
-    SEL_MONITOR_WS.first = workspaces[idx].first;
-    SEL_MONITOR_WS.curr = workspaces[idx].curr;
-    selected_monitor->curr_workspace = idx;
+    const char* text = status_text[segment];
+    XGlyphInfo extents;
+    int width = 0;
+
+    if (text[0]) {
+        XftTextExtentsUtf8(disp, font, (XftChar8*)text, strlen(text), &extents);
+        width = extents.xOff + 10;
+    }
+    if (width <= status_slot[segment]) {
+        return false;
+    }
+    status_slot[segment] = width;
+    return true;
 }
 
-// add window allocates a client and updates the global values
 static void
-add_window(Window w)
+handle_status(void)
 {
-    Monitor* m = monitor_from_window(w);
-    if (m != selected_monitor) {
-        focus_monitor(m);
+    uint64_t n;
+    StatusSample st;
+    unsigned int seq;
+
+    if (read(status_fd, &n, sizeof(n)) < 0 && errno != EAGAIN) {
+        return;
     }
 
-    Client* cl = calloc(1, sizeof(Client));
-    if (cl == NULL) {
-        die("failed calloc");
+    // the collector's next pass writes the buffer that isn't current. once it has
+    // published again the buffer copied here may be the one it's writing, so retry.
+    do {
+        seq = atomic_load_explicit(&status_seq, memory_order_acquire);
+        memcpy(&st, &status_buf[seq & 1], sizeof(st));
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&status_seq, memory_order_relaxed) != seq);
+
+    push_graph_samples(&st);
+
+    bool changed[StatusLast] = { false };
+    bool grown = false;
+    for (int i = 0; i < StatusLast; ++i) {
+        if (strcmp(st.text[i], status_text[i]) != 0) {
+            memcpy(status_text[i], st.text[i], sizeof(status_text[i]));
+            changed[i] = true;
+            grown |= font && update_slot(i);
+        }
     }
 
-    if (SEL_MONITOR_WS.first == NULL) {
-        // there are no existing clients so update them
-        cl->next = NULL;
-        cl->prev = NULL;
-        cl->window = w;
-        SEL_MONITOR_WS.first = cl;
-    } else {
-        Client* last;
-        for (last = SEL_MONITOR_WS.first; last->next != NULL; last = last->next)
-            ;
+    // a wider segment moves the others, that needs the whole bar
+    if (grown || !font) {
+        bars_dirty |= grown;
+        return;
+    }
 
-        cl->next = NULL;
-        cl->prev = last;
-        cl->window = w;
-        last->next = cl;
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (launcher_shown(m) || bars_dirty) {
+            continue;
+        }
+        if (graph_image) {
+            render_graphs(m);
+            XCopyArea(disp, m->buffer, m->bar_window, m->graphics_ctx,
+                graphs_x(m), 0, graph_image->width, bar_height, graphs_x(m), 0);
+        }
+        for (int i = 0; i < StatusLast; ++i) {
+            if (changed[i]) {
+                render_status(m, i);
+                XCopyArea(disp, m->buffer, m->bar_window, m->graphics_ctx,
+                    status_x(m, i), 0, status_slot[i], bar_height, status_x(m, i), 0);
+            }
+        }
     }
+}
 
-    // subscribe to events when the mouse moves to this window such that we can
-    // change the current window
-    XSelectInput(disp, w, EnterWindowMask);
+// render_title draws the focused client's title into the bar's buffer if it changed and
+// returns the width of the region that needs to be copied to the bar window. titles change
+// too often to be worth caching as text runs.
+static int
+render_title(Monitor* m)
+{
+    Client* cl = workspaces[m->curr_workspace].curr;
+    const char* title = cl ? client_name(cl) : "";
+    if (strcmp(title, m->title) == 0) {
+        return 0;
+    }
 
-    SEL_MONITOR_WS.curr = cl;
+    size_t len = strlen(title);
+    XGlyphInfo extents;
+    XftTextExtentsUtf8(disp, font, (XftChar8*)title, len, &extents);
+    int room = MAX(graphs_x(m) - m->tags_width, 0);
+    int width = MIN(extents.xOff + 10, room);
+
+    // clear what's left of the previous title as well, long titles are cut off before
+    // they reach the status segments
+    int dirty = MIN(MAX(width, m->title_width), room);
+    XRectangle clip = { m->tags_width, 0, room, bar_height };
+    XSetForeground(disp, m->graphics_ctx, unfocus_color);
+    XFillRectangle(disp, m->buffer, m->graphics_ctx, m->tags_width, 0, dirty, bar_height);
+    XftDrawSetClipRectangles(m->xft, 0, 0, &clip, 1);
+    XftDrawStringUtf8(m->xft, &xft_focus_color, font, m->tags_width + 5,
+        bar_height - (bar_height - font->ascent) / 2, (XftChar8*)title, len);
+    XftDrawSetClip(m->xft, None);
+
+    snprintf(m->title, sizeof(m->title), "%s", title);
+    m->title_width = width;
+    return dirty;
 }
 
-unsigned long
-get_color(const char* color)
+static void
+draw_title(Monitor* m)
 {
-    XColor c;
-    Colormap map = DefaultColormap(disp, main_screen);
-
-    if (!XAllocNamedColor(disp, map, color, &c, &c)) {
-        die("error parsing color");
+    if (!font || launcher_shown(m)) {
+        return;
     }
 
-    return c.pixel;
+    int width = render_title(m);
+    if (width > 0) {
+        XCopyArea(disp, m->buffer, m->bar_window, m->graphics_ctx,
+            m->tags_width, 0, width, bar_height, m->tags_width, 0);
+    }
 }
 
+// focus changes are rare enough to show right away
 static void
-sigchld(int _unused)
+draw_titles(void)
 {
-    // setup signal handling for child processes
-    if (signal(SIGCHLD, sigchld) == SIG_ERR) {
-        die("sigchld handler failed");
+    for (Monitor* m = monitors; m; m = m->next) {
+        draw_title(m);
     }
-    while (0 < waitpid(-1, NULL, WNOHANG))
-        ;
 }
 
 static void
-start(void)
+draw_monitor_bar(Monitor* m)
 {
-    XEvent event;
+    if (!draw_launcher(m)) {
+        XSetForeground(disp, m->graphics_ctx, unfocus_color);
+        XFillRectangle(disp, m->buffer, m->graphics_ctx, 0, 0, m->width, bar_height);
+    }
+
+    if (!launcher_shown(m) && font) {
+        int x = 0;
+        for (int i = 0; i < WORKSPACE_COUNT; i++) {
+            bool selected = i == m->curr_workspace;
+            x += draw_text(m, x, tags[i], selected ? &xft_unfocus_color : &xft_focus_color,
+                selected ? focus_color : unfocus_color);
+        }
 
-    while (!quit_flag && !XNextEvent(disp, &event)) {
-        // handle events we know how to handle
-        if (events[event.type]) {
-            events[event.type](&event);
+        for (int i = 0; i < StatusLast; ++i) {
+            update_slot(i);
+        }
+        for (int i = 0; i < StatusLast; ++i) {
+            render_status(m, i);
         }
+        render_graphs(m);
+
+        m->tags_width = x;
+        m->title[0] = '\0';
+        m->title_width = 0;
+        render_title(m);
     }
+
+    XCopyArea(disp, m->buffer, m->bar_window, m->graphics_ctx, 0, 0, m->width, bar_height, 0, 0);
 }
+#endif
 
-static void
-remove_window(Window w)
+// the shown scratchpad terminal has the focus over the selected workspace's clients
+static Client*
+focused_client(void)
 {
-    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
-        if (cl->window == w) {
-            if (cl->prev == NULL && cl->next == NULL) {
-                free(SEL_MONITOR_WS.first);
-                SEL_MONITOR_WS.first = NULL;
-                SEL_MONITOR_WS.curr = NULL;
-                return;
-            }
-
-            if (cl->prev == NULL) {
-                SEL_MONITOR_WS.first = cl->next;
-                cl->next->prev = NULL;
-                SEL_MONITOR_WS.curr = cl->next;
-            } else if (cl->next == NULL) {
-                cl->prev->next = NULL;
-                cl->next->prev = cl->prev;
-                SEL_MONITOR_WS.curr = cl->prev;
-            } else {
-                cl->prev->next = cl->next;
-                cl->next->prev = cl->prev;
-                SEL_MONITOR_WS.curr = cl->prev;
-            }
-        }
+    if (scratch_active && scratch_visible) {
+        return scratch_active;
     }
+    return SEL_MONITOR_WS.curr;
 }
 
 static void
-client_to_workspace(const Arg arg)
+update_curr(void)
+{
+    Client* focus = focused_client();
+    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
+        if (focus == cl) {
+            XSetWindowBorderWidth(disp, cl->window, cl->fullscreen ? 0 : 5);
+            XSetWindowBorder(disp, cl->window, focus_color);
+            XSetInputFocus(disp, cl->window, RevertToParent, CurrentTime);
+            XRaiseWindow(disp, cl->window);
+        } else {
+            XSetWindowBorder(disp, cl->window, unfocus_color);
+        }
+    }
+
+    // a fullscreen client stays on top of the clients it covers even if they're focused
+    if (SEL_MONITOR_WS.fullscreen) {
+        XRaiseWindow(disp, SEL_MONITOR_WS.fullscreen->window);
+    }
+
+    // and floating clients stay above both, the focused one on top
+    Client* curr = SEL_MONITOR_WS.curr;
+    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
+        if (cl->floating && cl != curr) {
+            XRaiseWindow(disp, cl->window);
+        }
+    }
+    if (curr && curr->floating) {
+        XRaiseWindow(disp, curr->window);
+    }
+
+    // the scratchpad stays above everything while it's shown
+    if (focus && focus == scratch_active) {
+        XRaiseWindow(disp, focus->window);
+        XSetInputFocus(disp, focus->window, RevertToParent, CurrentTime);
+    }
+}
+
+static void
+move_left(void)
+{
+    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
+        return;
+
+    SEL_MONITOR_WS.curr = SEL_MONITOR_WS.first;
+    focus_dirty = true;
+}
+
+static void
+move_right(void)
+{
+    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
+        return;
+
+    // If we're on master, move to the first stacked window
+    if (SEL_MONITOR_WS.curr == SEL_MONITOR_WS.first && SEL_MONITOR_WS.first->next) {
+        SEL_MONITOR_WS.curr = SEL_MONITOR_WS.first->next;
+    }
+    focus_dirty = true;
+}
+
+static void
+move_up(void)
+{
+    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
+        return;
+
+    // If we're not on master and have a previous window
+    if (SEL_MONITOR_WS.curr != SEL_MONITOR_WS.first && SEL_MONITOR_WS.curr->prev) {
+        SEL_MONITOR_WS.curr = SEL_MONITOR_WS.curr->prev;
+    }
+    focus_dirty = true;
+}
+
+static void
+move_down(void)
+{
+    if (!SEL_MONITOR_WS.curr || !SEL_MONITOR_WS.first)
+        return;
+
+    // If we have a next window
+    if (SEL_MONITOR_WS.curr->next) {
+        SEL_MONITOR_WS.curr = SEL_MONITOR_WS.curr->next;
+    }
+    focus_dirty = true;
+}
+
+#ifndef NOBAR
+static void
+cleanup_font(void)
+{
+    destroy_graph_image();
+    if (font_fd >= 0) {
+        // still matching, we can only wait for it
+        join_font_thread();
+        if (font_match) {
+            FcPatternDestroy(font_match);
+            font_match = NULL;
+        }
+    }
+
+    for (int i = 0; i < TEXT_CACHE_SIZE; ++i) {
+        free_text_run(&text_cache[i]);
+    }
+    if (xft) {
+        XftDrawDestroy(xft);
+        xft = NULL;
+    }
+
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (m->xft) {
+            XftDrawDestroy(m->xft);
+            m->xft = NULL;
+        }
+    }
+
+    if (font) {
+        XftFontClose(disp, font);
+        font = NULL;
+    }
+
+    XftColorFree(disp, DefaultVisual(disp, main_screen),
+        DefaultColormap(disp, main_screen), &xft_focus_color);
+    XftColorFree(disp, DefaultVisual(disp, main_screen),
+        DefaultColormap(disp, main_screen), &xft_unfocus_color);
+}
+
+static void
+draw_bar(void)
+{
+    for (Monitor* m = monitors; m; m = m->next) {
+        draw_monitor_bar(m);
+    }
+}
+
+static void
+expose(XEvent* e)
+{
+    XExposeEvent* ev = &e->xexpose;
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (ev->window == m->bar_window) {
+            // the buffer is always current
+            XCopyArea(disp, m->buffer, m->bar_window, m->graphics_ctx,
+                ev->x, ev->y, ev->width, ev->height, ev->x, ev->y);
+            break;
+        }
+    }
+}
+#else
+static int font_fd = -1;
+static int status_fd = -1;
+
+static void
+setup_status(void)
+{
+}
+
+static void
+handle_status(void)
+{
+}
+
+static void
+handle_font(void)
+{
+}
+
+static void
+setup_bar(void)
+{
+}
+
+static void
+cleanup_font(void)
+{
+}
+
+static void
+draw_titles(void)
+{
+}
+
+static void
+draw_bar(void)
+{
+}
+
+static void
+expose(XEvent* e)
+{
+    (void)e;
+}
+#endif
+
+static void
+resize(Client* cl, int x, int y, int width, int height)
+{
+    cl->x = x;
+    cl->y = y;
+    cl->width = width;
+    cl->height = height;
+    XMoveResizeWindow(disp, cl->window, x, y, width, height);
+}
+
+static Client*
+next_tiled(Client* cl)
+{
+    while (cl != NULL && cl->floating) {
+        cl = cl->next;
+    }
+    return cl;
+}
+
+static void
+tile_monitor(Monitor* m)
+{
+    // there are three different cases
+    // 1. there are no windows -> do nothing
+    // 2. there is a single window -> add space around the only window
+    // 3. there are multiple windows -> count the amount of windows and divide the space evenly
+    const int space = 10;
+    Client* fullscreen = workspaces[m->curr_workspace].fullscreen;
+
+    // a fullscreen client gets the whole monitor. the bar is unmapped instead of drawn
+    // over and the clients below aren't resized until fullscreen ends.
+    if (fullscreen) {
+#ifndef NOBAR
+        if (!m->bar_hidden) {
+            XUnmapWindow(disp, m->bar_window);
+            m->bar_hidden = true;
+        }
+#endif
+        XSetWindowBorderWidth(disp, fullscreen->window, 0);
+        resize(fullscreen, m->x, m->y, m->width, m->height);
+        XRaiseWindow(disp, fullscreen->window);
+        return;
+    }
+#ifndef NOBAR
+    if (m->bar_hidden) {
+        XMapWindow(disp, m->bar_window);
+        m->bar_hidden = false;
+    }
+#endif
+
+    // floating clients keep their place and don't take a tile
+    Client* master = next_tiled(workspaces[m->curr_workspace].first);
+    Client* stack = master ? next_tiled(master->next) : NULL;
+    if (master != NULL && stack == NULL) {
+        resize(master, m->wx + space, m->wy + space, m->ww - 3 * space, m->wh - 3 * space);
+    } else if (master != NULL && stack != NULL) {
+        const int master_size = 0.55 * m->ww;
+        resize(master, m->wx + space, m->wy + space, master_size, m->wh - 3 * space);
+        int x = m->wx + master_size + 3 * space;
+        int y = m->wy + space;
+        int tile_width = m->ww - master_size - 5 * space;
+        int nwindows = 0;
+
+        for (Client* cl = stack; cl != NULL; cl = next_tiled(cl->next))
+            ++nwindows;
+
+        for (Client* cl = stack; cl != NULL; cl = next_tiled(cl->next)) {
+            resize(cl, x, y, tile_width, (m->wh / nwindows) - 2 * space);
+            y += m->wh / nwindows;
+        }
+    }
+}
+
+// layout, focus and bar changes are only recorded where they happen and applied once
+// per batch of events by commit(), so a burst of changes costs a single relayout.
+static void
+arrange(Monitor* m)
+{
+    if (m) {
+        m->dirty = true;
+    }
+    focus_dirty = true;
+}
+
+static Monitor*
+monitor_from_window(Window w)
+{
+    if (w == rootwin) {
+        return selected_monitor;
+    }
+
+    int x, y;
+    Window child;
+    XTranslateCoordinates(disp, w, rootwin, 0, 0, &x, &y, &child);
+
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (x >= m->x && x < m->x + m->width &&
+            y >= m->y && y < m->y + m->height)
+            return m;
+    }
+
+    return selected_monitor;
+}
+
+static void
+focus_monitor(Monitor* m)
+{
+    if (m && m != selected_monitor) {
+        selected_monitor = m;
+        focus_dirty = true;
+        bars_dirty = true;
+    }
+}
+
+static void
+focus_next_monitor()
+{
+    if (!selected_monitor || !selected_monitor->next) {
+        return;
+    }
+
+    focus_monitor(selected_monitor->next);
+}
+
+// files shared with other processes live in XDG_RUNTIME_DIR and are keyed by display.
+// stupidc builds the same paths.
+static bool
+runtime_path(char* buf, size_t size, const char* suffix)
+{
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL) {
+        return false;
+    }
+
+    snprintf(buf, size, "%s/stupidwm-%s.%s", dir, DisplayString(disp), suffix);
+    return true;
+}
+
+#define JOURNAL_MAGIC   0x4a4d5753 // "SWMJ"
+#define JOURNAL_RECORDS 4096
+
+enum {
+    JournalEmpty, // unused slot, marks the end of the journal
+    JournalAttach, // window was appended to workspace arg
+    JournalDetach, // window was removed from its workspace
+    JournalSwap, // window swapped its position with window arg
+};
+
+// a fixed size journal record. op is written last so that a record only becomes part
+// of the journal once it's complete, even if we crash halfway through writing it.
+typedef struct {
+    uint32_t window;
+    uint32_t arg;
+    uint32_t pad;
+    _Atomic uint32_t op;
+} JournalRecord;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t capacity;
+    uint32_t pad[2];
+    JournalRecord records[];
+} Journal;
+
+typedef struct {
+    Window window;
+    int ws;
+} JournalEntry;
+
+// the journal lives in a shared file mapping so the kernel keeps the records even if
+// the wm crashes. no fsync is done, the journal only has to outlive the process.
+static Journal* journal;
+static size_t journal_len;
+static bool journal_ready; // records are only written after the startup compaction
+static JournalEntry* journal_state; // the replayed journal, in client order
+static int journal_nstate;
+
+static void
+journal_state_remove(Window w)
+{
+    for (int i = 0; i < journal_nstate; ++i) {
+        if (journal_state[i].window == w) {
+            memmove(&journal_state[i], &journal_state[i + 1], (journal_nstate - i - 1) * sizeof(JournalEntry));
+            --journal_nstate;
+            return;
+        }
+    }
+}
+
+// replay the records into the flat list of (window, workspace) pairs in client order.
+static void
+journal_replay(void)
+{
+    journal_state = calloc(journal->capacity, sizeof(JournalEntry));
+    if (journal_state == NULL) {
+        die("failed calloc");
+    }
+
+    for (journal_len = 0; journal_len < journal->capacity; ++journal_len) {
+        JournalRecord* r = &journal->records[journal_len];
+        uint32_t op = atomic_load_explicit(&r->op, memory_order_acquire);
+        if (op == JournalEmpty) {
+            break;
+        }
+
+        if (op == JournalAttach && r->arg < WORKSPACE_TOTAL) {
+            journal_state_remove(r->window);
+            journal_state[journal_nstate++] = (JournalEntry) { r->window, r->arg };
+        } else if (op == JournalDetach) {
+            journal_state_remove(r->window);
+        } else if (op == JournalSwap) {
+            JournalEntry *a = NULL, *b = NULL;
+            for (int i = 0; i < journal_nstate; ++i) {
+                if (journal_state[i].window == r->window) {
+                    a = &journal_state[i];
+                } else if (journal_state[i].window == r->arg) {
+                    b = &journal_state[i];
+                }
+            }
+            if (a && b) {
+                a->window = r->arg;
+                b->window = r->window;
+            }
+        }
+    }
+}
+
+static void
+journal_open(void)
+{
+    char path[512];
+
+    if (!runtime_path(path, sizeof(path), "journal")) {
+        return;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+
+    size_t size = sizeof(Journal) + JOURNAL_RECORDS * sizeof(JournalRecord);
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return;
+    }
+
+    journal = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (journal == MAP_FAILED) {
+        journal = NULL;
+        return;
+    }
+
+    if (journal->magic != JOURNAL_MAGIC || journal->capacity != JOURNAL_RECORDS) {
+        memset(journal, 0, size);
+        journal->magic = JOURNAL_MAGIC;
+        journal->capacity = JOURNAL_RECORDS;
+    }
+
+    journal_replay();
+}
+
+// returns the workspace the journal last saw the window on or -1 if it doesn't know it.
+static int
+journal_lookup(Window w)
+{
+    for (int i = 0; i < journal_nstate; ++i) {
+        if (journal_state[i].window == w) {
+            return journal_state[i].ws;
+        }
+    }
+    return -1;
+}
+
+static void journal_compact(void);
+
+static void
+journal_log(uint32_t op, Window w, uint32_t arg)
+{
+    if (!journal || !journal_ready) {
+        return;
+    }
+    if (journal_len == journal->capacity) {
+        // compaction rewrites the current state, which already includes this change
+        journal_compact();
+        return;
+    }
+
+    JournalRecord* r = &journal->records[journal_len++];
+    r->window = w;
+    r->arg = arg;
+    atomic_store_explicit(&r->op, op, memory_order_release);
+}
+
+// replace the journal with the minimal set of records describing the current state.
+static void
+journal_compact(void)
+{
+    if (!journal) {
+        return;
+    }
+
+    memset(journal->records, 0, journal->capacity * sizeof(JournalRecord));
+    journal_len = 0;
+    journal_ready = true;
+
+    free(journal_state);
+    journal_state = NULL;
+    journal_nstate = 0;
+
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        for (Client* cl = workspaces[i].first; cl != NULL && journal_len < journal->capacity; cl = cl->next) {
+            journal_log(JournalAttach, cl->window, i);
+        }
+    }
+}
+
+// a clean shutdown leaves no windows behind so there is nothing to restore.
+static void
+journal_close(void)
+{
+    char path[512];
+
+    if (!journal) {
+        return;
+    }
+
+    munmap(journal, sizeof(Journal) + journal->capacity * sizeof(JournalRecord));
+    journal = NULL;
+    if (runtime_path(path, sizeof(path), "journal")) {
+        unlink(path);
+    }
+}
+
+// _NET_CLIENT_LIST in the order the clients were managed. new clients are appended to
+// the root property, only a removal rewrites it completely.
+static Window* client_list;
+static int nclient_list, client_list_cap;
+static int client_list_published; // entries already written to the root window
+static bool client_list_rewrite = true; // a stale list from a previous instance is replaced
+
+static void
+client_list_add(Window w)
+{
+    if (nclient_list == client_list_cap) {
+        client_list_cap = client_list_cap ? client_list_cap * 2 : 64;
+        client_list = realloc(client_list, client_list_cap * sizeof(Window));
+        if (client_list == NULL) {
+            die("failed realloc");
+        }
+    }
+    client_list[nclient_list++] = w;
+}
+
+static void
+client_list_remove(Window w)
+{
+    for (int i = 0; i < nclient_list; ++i) {
+        if (client_list[i] == w) {
+            memmove(&client_list[i], &client_list[i + 1], (nclient_list - i - 1) * sizeof(Window));
+            --nclient_list;
+            client_list_rewrite = true;
+            return;
+        }
+    }
+}
+
+// has_atom tells if the atom list property of the window contains any of the values.
+static bool
+has_atom(Window w, Atom property, const Atom* values, int nvalues)
+{
+    Atom type;
+    int format;
+    unsigned long nitems, remaining;
+    unsigned char* data = NULL;
+    bool found = false;
+
+    if (XGetWindowProperty(disp, w, property, 0, 32, False, XA_ATOM,
+            &type, &format, &nitems, &remaining, &data)
+        == Success) {
+        for (unsigned long i = 0; type == XA_ATOM && i < nitems && !found; ++i) {
+            for (int j = 0; j < nvalues; ++j) {
+                if (((Atom*)data)[i] == values[j]) {
+                    found = true;
+                }
+            }
+        }
+        XFree(data);
+    }
+    return found;
+}
+
+static Client*
+create_client(Window w)
+{
+    Client* cl = calloc(1, sizeof(Client));
+    if (cl == NULL) {
+        die("failed calloc");
+    }
+    cl->window = w;
+
+    // subscribe to events when the mouse moves to this window such that we can
+    // change the current window, and to property changes to follow its title
+    XSelectInput(disp, w, EnterWindowMask | PropertyChangeMask);
+    return cl;
+}
+
+// _NET_WM_STATE is written from what we track about the client, states we don't support
+// are dropped.
+static void
+write_net_wm_state(Client* cl)
+{
+    Atom state[2];
+    int n = 0;
+
+    if (cl->wm_state == IconicState) {
+        state[n++] = atoms[NetWMStateHidden];
+    }
+    if (cl->fullscreen) {
+        state[n++] = atoms[NetWMStateFullscreen];
+    }
+    XChangeProperty(disp, cl->window, atoms[NetWMState], XA_ATOM, 32,
+        PropModeReplace, (unsigned char*)state, n);
+}
+
+static void
+update_protocols(Client* cl)
+{
+    Atom* protocols;
+    int n;
+
+    cl->protocols = 0;
+    if (!XGetWMProtocols(disp, cl->window, &protocols, &n)) {
+        return;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        if (protocols[i] == atoms[WMDelete]) {
+            cl->protocols |= ProtoDelete;
+        } else if (protocols[i] == atoms[NetWMPing]) {
+            cl->protocols |= ProtoPing;
+        }
+    }
+    XFree(protocols);
+}
+
+// probe_client reads what a new client asks for. it's only done for windows we haven't
+// managed before, a restored snapshot already knows all of it.
+static void
+probe_client(Client* cl)
+{
+    update_protocols(cl);
+
+    // players often ask for fullscreen before their window is mapped
+    cl->fullscreen = has_atom(cl->window, atoms[NetWMState], &atoms[NetWMStateFullscreen], 1);
+
+    // dialogs, file pickers and the like aren't tiled. the floating window types follow
+    // each other in atoms.
+    cl->floating = XGetTransientForHint(disp, cl->window, &cl->transient_for)
+        || has_atom(cl->window, atoms[NetWMWindowType], &atoms[NetWMWindowTypeDialog], 3);
+}
+
+// remember the workspace on the window itself so that a restarted wm can put the
+// window back where it was.
+static void
+set_workspace_hint(Window w, int ws)
+{
+    long data = ws;
+    XChangeProperty(disp, w, atoms[StupidWorkspace], XA_CARDINAL, 32,
+        PropModeReplace, (unsigned char*)&data, 1);
+}
+
+static int
+get_workspace_hint(Window w)
+{
+    Atom type;
+    int format;
+    unsigned long nitems, remaining;
+    unsigned char* data = NULL;
+    int ws = -1;
+
+    if (XGetWindowProperty(disp, w, atoms[StupidWorkspace], 0, 1, False, XA_CARDINAL,
+            &type, &format, &nitems, &remaining, &data)
+        == Success) {
+        if (type == XA_CARDINAL && format == 32 && nitems == 1) {
+            ws = *(long*)data;
+        }
+        XFree(data);
+    }
+
+    return (ws >= 0 && ws < WORKSPACE_TOTAL) ? ws : -1;
+}
+
+// attach appends the client to the end of the workspace's client list.
+static void
+attach(Client* cl, int ws)
+{
+    cl->next = NULL;
+    cl->prev = NULL;
+    if (workspaces[ws].first == NULL) {
+        workspaces[ws].first = cl;
+    } else {
+        Client* last;
+        for (last = workspaces[ws].first; last->next != NULL; last = last->next)
+            ;
+        cl->prev = last;
+        last->next = cl;
+    }
+
+    set_workspace_hint(cl->window, ws);
+    workspaces[ws].state_dirty = true;
+    if (cl->fullscreen) {
+        // a workspace only has room for one fullscreen client
+        if (workspaces[ws].fullscreen == NULL) {
+            workspaces[ws].fullscreen = cl;
+        } else {
+            cl->fullscreen = false;
+            XSetWindowBorderWidth(disp, cl->window, 5);
+            write_net_wm_state(cl);
+        }
+    }
+    journal_log(JournalAttach, cl->window, ws);
+    ipc_event("client_add 0x%lx %d", cl->window, ws);
+}
+
+// detach unlinks the client from the workspace and moves the focus of the workspace
+// to a neighbouring client if the detached client was focused.
+static void
+detach(Client* cl, int ws)
+{
+    if (workspaces[ws].curr == cl) {
+        workspaces[ws].curr = cl->prev ? cl->prev : cl->next;
+    }
+    if (workspaces[ws].fullscreen == cl) {
+        workspaces[ws].fullscreen = NULL;
+    }
+
+    if (cl->prev) {
+        cl->prev->next = cl->next;
+    } else {
+        workspaces[ws].first = cl->next;
+    }
+    if (cl->next) {
+        cl->next->prev = cl->prev;
+    }
+    cl->next = NULL;
+    cl->prev = NULL;
+    journal_log(JournalDetach, cl->window, 0);
+    ipc_event("client_remove 0x%lx", cl->window);
+}
+
+static Client*
+find_client(Window w, int* ws)
+{
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        for (Client* cl = workspaces[i].first; cl != NULL; cl = cl->next) {
+            if (cl->window == w) {
+                if (ws) {
+                    *ws = i;
+                }
+                return cl;
+            }
+        }
+    }
+    return NULL;
+}
+
+// returns the first monitor that displays the given workspace or NULL if the workspace
+// is hidden.
+static Monitor*
+workspace_monitor(int ws)
+{
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (m->curr_workspace == ws) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+// floating clients are centred on the monitor and keep the size they asked for.
+static void
+place_floating(Client* cl, Monitor* m)
+{
+    Window root;
+    int x, y;
+    unsigned int width, height, border, depth;
+
+    if (!XGetGeometry(disp, cl->window, &root, &x, &y, &width, &height, &border, &depth)) {
+        return;
+    }
+    width = width < (unsigned int)m->width ? width : (unsigned int)m->width;
+    height = height < (unsigned int)m->height ? height : (unsigned int)m->height;
+    resize(cl, m->x + (m->width - (int)width) / 2, m->y + (m->height - (int)height) / 2, width, height);
+    cl->float_x = cl->x;
+    cl->float_y = cl->y;
+    cl->float_width = cl->width;
+    cl->float_height = cl->height;
+}
+
+// docks like external bars and trays aren't managed, they only take space away from the
+// monitors through their struts. the work area of each monitor is cached and only
+// recomputed when a strut changes.
+typedef struct {
+    Window window;
+    long strut[12]; // _NET_WM_STRUT_PARTIAL layout
+} Dock;
+
+static Dock docks[MAX_DOCKS];
+static int ndocks;
+
+static bool
+read_strut(Window w, long strut[12])
+{
+    Atom type;
+    int format;
+    unsigned long nitems, remaining;
+    unsigned char* data = NULL;
+    bool found = false;
+
+    memset(strut, 0, 12 * sizeof(long));
+    if (XGetWindowProperty(disp, w, atoms[NetWMStrutPartial], 0, 12, False, XA_CARDINAL,
+            &type, &format, &nitems, &remaining, &data)
+            == Success
+        && type == XA_CARDINAL && nitems == 12) {
+        memcpy(strut, data, 12 * sizeof(long));
+        found = true;
+    }
+    if (data) {
+        XFree(data);
+        data = NULL;
+    }
+    if (found) {
+        return true;
+    }
+
+    // the old property reserves the whole length of the screen edge
+    if (XGetWindowProperty(disp, w, atoms[NetWMStrut], 0, 4, False, XA_CARDINAL,
+            &type, &format, &nitems, &remaining, &data)
+            == Success
+        && type == XA_CARDINAL && nitems == 4) {
+        memcpy(strut, data, 4 * sizeof(long));
+        for (int i = 4; i < 12; i += 2) {
+            strut[i + 1] = LONG_MAX;
+        }
+        found = true;
+    }
+    if (data) {
+        XFree(data);
+    }
+    return found;
+}
+
+static bool
+overlaps(long start, long end, int from, int length)
+{
+    return start < from + length && end >= from;
+}
+
+// update_workarea returns whether the work area of the monitor changed.
+static bool
+update_workarea(Monitor* m)
+{
+    const int screen_width = DisplayWidth(disp, main_screen);
+    const int screen_height = DisplayHeight(disp, main_screen);
+    int left = 0, right = 0, top = bar_height, bottom = 0;
+
+    for (int i = 0; i < ndocks; ++i) {
+        long* s = docks[i].strut;
+        if (s[0] > m->x && overlaps(s[4], s[5], m->y, m->height)) {
+            left = MAX(left, s[0] - m->x);
+        }
+        if (s[1] > 0 && screen_width - s[1] < m->x + m->width && overlaps(s[6], s[7], m->y, m->height)) {
+            right = MAX(right, m->x + m->width - (screen_width - s[1]));
+        }
+        if (s[2] > m->y && overlaps(s[8], s[9], m->x, m->width)) {
+            top = MAX(top, s[2] - m->y);
+        }
+        if (s[3] > 0 && screen_height - s[3] < m->y + m->height && overlaps(s[10], s[11], m->x, m->width)) {
+            bottom = MAX(bottom, m->y + m->height - (screen_height - s[3]));
+        }
+    }
+
+    // a dock can't take the whole monitor
+    left = MIN(left, m->width / 2);
+    right = MIN(right, m->width / 2);
+    top = MIN(top, m->height / 2);
+    bottom = MIN(bottom, m->height / 2);
+
+    int wx = m->x + left, wy = m->y + top;
+    int ww = m->width - left - right, wh = m->height - top - bottom;
+    if (wx == m->wx && wy == m->wy && ww == m->ww && wh == m->wh) {
+        return false;
+    }
+
+    m->wx = wx;
+    m->wy = wy;
+    m->ww = ww;
+    m->wh = wh;
+    return true;
+}
+
+// only the monitors whose work area changed are laid out again
+static void
+update_workareas(void)
+{
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (update_workarea(m)) {
+            arrange(m);
+        }
+    }
+}
+
+static Dock*
+find_dock(Window w)
+{
+    for (int i = 0; i < ndocks; ++i) {
+        if (docks[i].window == w) {
+            return &docks[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+update_dock(Dock* d)
+{
+    long strut[12];
+    read_strut(d->window, strut);
+    if (memcmp(strut, d->strut, sizeof(strut)) != 0) {
+        memcpy(d->strut, strut, sizeof(strut));
+        update_workareas();
+    }
+}
+
+// add_dock starts tracking the window if it's a dock and tells if it was one.
+static bool
+add_dock(Window w)
+{
+    // docks that hide themselves are mapped again, they're still tracked from before
+    Dock* d = find_dock(w);
+    if (d) {
+        update_dock(d);
+        return true;
+    }
+
+    long strut[12];
+    bool has_strut = read_strut(w, strut);
+    if (!has_strut && !has_atom(w, atoms[NetWMWindowType], &atoms[NetWMWindowTypeDock], 1)) {
+        return false;
+    }
+    if (ndocks == MAX_DOCKS) {
+        // still keep it out of the tiling, it just doesn't get its space reserved
+        return true;
+    }
+
+    docks[ndocks].window = w;
+    memcpy(docks[ndocks].strut, strut, sizeof(strut));
+    ++ndocks;
+    XSelectInput(disp, w, PropertyChangeMask);
+    if (has_strut) {
+        update_workareas();
+    }
+    return true;
+}
+
+static bool
+remove_dock(Window w)
+{
+    Dock* d = find_dock(w);
+    if (d == NULL) {
+        return false;
+    }
+
+    *d = docks[--ndocks];
+    update_workareas();
+    return true;
+}
+
+unsigned long
+get_color(const char* color)
+{
+    XColor c;
+    Colormap map = DefaultColormap(disp, main_screen);
+
+    if (!XAllocNamedColor(disp, map, color, &c, &c)) {
+        die("error parsing color");
+    }
+
+    return c.pixel;
+}
+
+static long long
+now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// a process started by spawn. the slot is kept until the process exits so that later
+// windows of the same process end up in the same place as the first one.
+typedef struct {
+    pid_t pid; // 0 if the slot is unused
+    long long started; // monotonic ms
+    bool mapped;
+    char command[32];
+    char startup_id[48]; // DESKTOP_STARTUP_ID handed to the process
+    int ws; // workspace and monitor the process was launched from
+    Monitor* monitor;
+} Launch;
+
+// launch latency, from spawn to the first mapped window, aggregated per command.
+typedef struct {
+    char command[32];
+    unsigned int count;
+    long long total_ms;
+    long long min_ms;
+    long long max_ms;
+} LaunchStats;
+
+static Launch launches[MAX_LAUNCHES];
+static LaunchStats launch_stats[MAX_LAUNCHES];
+
+static void
+track_launch(pid_t pid, const char* command, const char* startup_id, int ws)
+{
+    Launch* slot = &launches[0];
+    for (int i = 0; i < MAX_LAUNCHES; ++i) {
+        if (launches[i].pid == 0) {
+            slot = &launches[i];
+            break;
+        }
+        // all slots are taken so reuse the oldest one
+        if (launches[i].started < slot->started) {
+            slot = &launches[i];
+        }
+    }
+
+    slot->pid = pid;
+    slot->started = now_ms();
+    slot->mapped = false;
+    slot->ws = ws;
+    slot->monitor = selected_monitor;
+    snprintf(slot->command, sizeof(slot->command), "%s", command);
+    snprintf(slot->startup_id, sizeof(slot->startup_id), "%s", startup_id);
+}
+
+static void
+forget_launch(pid_t pid)
+{
+    for (int i = 0; i < MAX_LAUNCHES; ++i) {
+        if (launches[i].pid == pid) {
+            launches[i].pid = 0;
+        }
+    }
+}
+
+static void
+record_launch_latency(const char* command, long long ms)
+{
+    LaunchStats* st = NULL;
+    for (int i = 0; i < MAX_LAUNCHES && st == NULL; ++i) {
+        if (launch_stats[i].count == 0 || strcmp(launch_stats[i].command, command) == 0) {
+            st = &launch_stats[i];
+        }
+    }
+    if (st == NULL) {
+        return;
+    }
+
+    if (st->count == 0) {
+        snprintf(st->command, sizeof(st->command), "%s", command);
+        st->min_ms = ms;
+        st->max_ms = ms;
+    }
+    ++st->count;
+    st->total_ms += ms;
+    st->min_ms = ms < st->min_ms ? ms : st->min_ms;
+    st->max_ms = ms > st->max_ms ? ms : st->max_ms;
+}
+
+static pid_t
+window_pid(Window w)
+{
+    Atom type;
+    int format;
+    unsigned long nitems, remaining;
+    unsigned char* data = NULL;
+    pid_t pid = 0;
+
+    if (XGetWindowProperty(disp, w, atoms[NetWMPid], 0, 1, False, XA_CARDINAL,
+            &type, &format, &nitems, &remaining, &data)
+        == Success) {
+        if (type == XA_CARDINAL && format == 32 && nitems == 1) {
+            pid = *(long*)data;
+        }
+        XFree(data);
+    }
+    return pid;
+}
+
+static bool
+window_startup_id(Window w, char* buf, size_t size)
+{
+    Atom type;
+    int format;
+    unsigned long nitems, remaining;
+    unsigned char* data = NULL;
+    bool found = false;
+
+    if (XGetWindowProperty(disp, w, atoms[NetStartupId], 0, size / 4, False, atoms[UTF8String],
+            &type, &format, &nitems, &remaining, &data)
+        == Success) {
+        if (type == atoms[UTF8String] && format == 8 && nitems > 0) {
+            snprintf(buf, size, "%.*s", (int)nitems, (char*)data);
+            found = true;
+        }
+        XFree(data);
+    }
+    return found;
+}
+
+// returns the launch the window belongs to, if it was started by us. the startup id
+// is preferred since it survives processes that fork, the pid is the fallback. the
+// first window of a launch records how long the process took to show up.
+static Launch*
+match_launch(Window w)
+{
+    char startup_id[48];
+    bool has_id = window_startup_id(w, startup_id, sizeof(startup_id));
+    pid_t pid = window_pid(w);
+    if (pid == 0 && !has_id) {
+        return NULL;
+    }
+
+    // single instance programs open windows for later launches from the first process,
+    // so a pid match is only used when no launch has the window's startup id.
+    Launch* l = NULL;
+    for (int i = 0; has_id && i < MAX_LAUNCHES && l == NULL; ++i) {
+        if (launches[i].pid != 0 && strcmp(launches[i].startup_id, startup_id) == 0) {
+            l = &launches[i];
+        }
+    }
+    for (int i = 0; pid != 0 && i < MAX_LAUNCHES && l == NULL; ++i) {
+        if (launches[i].pid == pid) {
+            l = &launches[i];
+        }
+    }
+    if (l == NULL) {
+        return NULL;
+    }
+
+    if (!l->mapped) {
+        long long ms = now_ms() - l->started;
+        l->mapped = true;
+        record_launch_latency(l->command, ms);
+        fprintf(stdout, "stupidwm: %s mapped %lld ms after spawn\n", l->command, ms);
+    }
+    return l;
+}
+
+static void
+dump_stats(void)
+{
+    fprintf(stdout, "stupidwm: launch latency (count avg min max ms)\n");
+    for (int i = 0; i < MAX_LAUNCHES && launch_stats[i].count > 0; ++i) {
+        LaunchStats* st = &launch_stats[i];
+        fprintf(stdout, "  %-24s %6u %6lld %6lld %6lld\n", st->command, st->count,
+            st->total_ms / st->count, st->min_ms, st->max_ms);
+    }
+
+    unsigned long long total = 0;
+    for (int i = 0; i < LASTEvent; ++i) {
+        total += event_counts[i];
+    }
+    fprintf(stdout, "stupidwm: %llu events handled in %llu commits\n", total, commit_count);
+    fflush(stdout);
+}
+
+// signals are handled from the main loop. SIGCHLD and SIGUSR1 stay blocked and are read
+// from a signalfd so nothing runs in signal context. SIGUSR1 dumps the statistics.
+static void
+setup_signals(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR1);
+
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        die("failed to block signals");
+    }
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+        die("failed to create signalfd");
+    }
+}
+
+static void
+handle_signals(void)
+{
+    struct signalfd_siginfo si;
+    pid_t pid;
+
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo == SIGUSR1) {
+            dump_stats();
+        }
+    }
+    while (0 < (pid = waitpid(-1, NULL, WNOHANG))) {
+        forget_launch(pid);
+    }
+}
+
+// timers are one-shot callbacks run from the main loop. there are usually only a handful
+// of them so a flat array is plenty.
+typedef struct {
+    long long deadline; // monotonic ms, 0 if the slot is unused
+    void (*fire)(void* arg);
+    void* arg;
+} Timer;
+
+static Timer* timers;
+static int ntimers;
+
+static void
+add_timer(long long delay_ms, void (*fire)(void*), void* arg)
+{
+    int i = 0;
+    while (i < ntimers && timers[i].deadline != 0) {
+        ++i;
+    }
+
+    // out of slots. a deadline such as the kill timeout must never fire early, so the
+    // table grows instead.
+    if (i == ntimers) {
+        int n = ntimers ? ntimers * 2 : MAX_TIMERS;
+        timers = realloc(timers, n * sizeof(Timer));
+        if (timers == NULL) {
+            die("failed realloc");
+        }
+        memset(timers + ntimers, 0, (n - ntimers) * sizeof(Timer));
+        ntimers = n;
+    }
+    timers[i] = (Timer) { now_ms() + delay_ms, fire, arg };
+}
+
+// cancel all pending timers that were registered with the given argument.
+static void
+cancel_timers(void* arg)
+{
+    for (int i = 0; i < ntimers; ++i) {
+        if (timers[i].deadline != 0 && timers[i].arg == arg) {
+            timers[i].deadline = 0;
+        }
+    }
+}
+
+// returns the poll timeout until the next timer is due or -1 if there is none.
+static int
+next_timeout(void)
+{
+    long long next = -1;
+    long long now = now_ms();
+
+    for (int i = 0; i < ntimers; ++i) {
+        if (timers[i].deadline != 0 && (next < 0 || timers[i].deadline < next)) {
+            next = timers[i].deadline;
+        }
+    }
+
+    if (next < 0) {
+        return -1;
+    }
+    return next <= now ? 0 : (int)(next - now);
+}
+
+static void
+run_timers(void)
+{
+    long long now = now_ms();
+
+    for (int i = 0; i < ntimers; ++i) {
+        if (timers[i].deadline != 0 && timers[i].deadline <= now) {
+            Timer t = timers[i];
+            timers[i].deadline = 0;
+            t.fire(t.arg);
+        }
+    }
+}
+
+#ifndef NOBAR
+// the executables found in PATH, kept as one string arena with a sorted offset table so
+// that prefix lookups are a binary search.
+static struct {
+    char* arena;
+    size_t len, cap;
+    uint32_t* names;
+    size_t count, names_cap;
+} exec_index;
+
+static int inotify_fd = -1;
+static bool index_rebuild_pending;
+
+static struct {
+    bool active;
+    char input[128];
+    size_t len;
+    int selected;
+    uint32_t matches[LAUNCHER_MATCHES];
+    int nmatches;
+} launcher;
+
+static int
+cmp_exec_names(const void* a, const void* b)
+{
+    return strcmp(exec_index.arena + *(const uint32_t*)a, exec_index.arena + *(const uint32_t*)b);
+}
+
+static void
+index_add(const char* name)
+{
+    size_t n = strlen(name) + 1;
+    while (exec_index.len + n > exec_index.cap) {
+        exec_index.cap = exec_index.cap ? exec_index.cap * 2 : 16384;
+        exec_index.arena = realloc(exec_index.arena, exec_index.cap);
+        if (exec_index.arena == NULL) {
+            die("failed realloc");
+        }
+    }
+    if (exec_index.count == exec_index.names_cap) {
+        exec_index.names_cap = exec_index.names_cap ? exec_index.names_cap * 2 : 1024;
+        exec_index.names = realloc(exec_index.names, exec_index.names_cap * sizeof(uint32_t));
+        if (exec_index.names == NULL) {
+            die("failed realloc");
+        }
+    }
+
+    memcpy(exec_index.arena + exec_index.len, name, n);
+    exec_index.names[exec_index.count++] = exec_index.len;
+    exec_index.len += n;
+}
+
+static void
+build_exec_index(void)
+{
+    const char* path = getenv("PATH");
+    char dir[4096];
+
+    exec_index.len = 0;
+    exec_index.count = 0;
+
+    for (const char* p = path; p && *p;) {
+        const char* end = strchr(p, ':');
+        size_t n = end ? (size_t)(end - p) : strlen(p);
+        snprintf(dir, sizeof(dir), "%.*s", (int)n, p);
+        p = end ? end + 1 : p + n;
+
+        DIR* d = opendir(dir);
+        if (d == NULL) {
+            continue;
+        }
+        for (struct dirent* ent; (ent = readdir(d));) {
+            struct stat st;
+            if (ent->d_name[0] == '.'
+                || fstatat(dirfd(d), ent->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode)
+                || faccessat(dirfd(d), ent->d_name, X_OK, 0) < 0) {
+                continue;
+            }
+            index_add(ent->d_name);
+        }
+        closedir(d);
+    }
+
+    qsort(exec_index.names, exec_index.count, sizeof(uint32_t), cmp_exec_names);
+
+    // the same name can live in multiple directories, only the first one matters
+    size_t unique = 0;
+    for (size_t i = 0; i < exec_index.count; ++i) {
+        if (unique == 0 || strcmp(exec_index.arena + exec_index.names[unique - 1], exec_index.arena + exec_index.names[i]) != 0) {
+            exec_index.names[unique++] = exec_index.names[i];
+        }
+    }
+    exec_index.count = unique;
+}
+
+// watch every PATH directory so that the index can be kept current without scanning
+// PATH every time the launcher is opened.
+static void
+setup_exec_index(void)
+{
+    const char* path = getenv("PATH");
+    char dir[4096];
+
+    build_exec_index();
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        return;
+    }
+    for (const char* p = path; p && *p;) {
+        const char* end = strchr(p, ':');
+        size_t n = end ? (size_t)(end - p) : strlen(p);
+        snprintf(dir, sizeof(dir), "%.*s", (int)n, p);
+        p = end ? end + 1 : p + n;
+
+        inotify_add_watch(inotify_fd, dir, IN_CREATE | IN_DELETE | IN_MOVE | IN_ATTRIB | IN_ONLYDIR);
+    }
+}
+
+// a subsequence match, e.g. "ffx" matches "firefox".
+static bool
+fuzzy_match(const char* pattern, const char* name)
+{
+    for (; *pattern && *name; ++name) {
+        if (*pattern == *name) {
+            ++pattern;
+        }
+    }
+    return *pattern == '\0';
+}
+
+// prefix matches come first in sorted order, followed by fuzzy matches.
+static void
+launcher_match(void)
+{
+    const char* input = launcher.input;
+    size_t lo = 0, hi = exec_index.count;
+
+    launcher.nmatches = 0;
+    launcher.selected = 0;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strncmp(exec_index.arena + exec_index.names[mid], input, launcher.len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t prefix_end = lo;
+    for (; prefix_end < exec_index.count && launcher.nmatches < LAUNCHER_MATCHES; ++prefix_end) {
+        uint32_t off = exec_index.names[prefix_end];
+        if (strncmp(exec_index.arena + off, input, launcher.len) != 0) {
+            break;
+        }
+        launcher.matches[launcher.nmatches++] = off;
+    }
+
+    if (launcher.len == 0) {
+        return;
+    }
+    for (size_t i = 0; i < exec_index.count && launcher.nmatches < LAUNCHER_MATCHES; ++i) {
+        if (i >= lo && i < prefix_end) {
+            continue;
+        }
+        uint32_t off = exec_index.names[i];
+        if (fuzzy_match(input, exec_index.arena + off)) {
+            launcher.matches[launcher.nmatches++] = off;
+        }
+    }
+}
+
+static void
+rebuild_exec_index(void* _unused)
+{
+    (void)_unused;
+    index_rebuild_pending = false;
+    build_exec_index();
+
+    // the offsets of the shown matches are stale once the arena is rebuilt
+    if (launcher.active) {
+        launcher_match();
+        draw_monitor_bar(selected_monitor);
+    }
+}
+
+static void
+handle_inotify(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (read(inotify_fd, buf, sizeof(buf)) > 0)
+        ;
+    if (!index_rebuild_pending) {
+        index_rebuild_pending = true;
+        add_timer(INDEX_REBUILD_MS, rebuild_exec_index, &exec_index);
+    }
+}
+
+static void
+launcher_open(void)
+{
+    if (launcher.active || !font) {
+        return;
+    }
+    if (XGrabKeyboard(disp, rootwin, True, GrabModeAsync, GrabModeAsync, CurrentTime) != GrabSuccess) {
+        return;
+    }
+
+    launcher.active = true;
+    launcher.len = 0;
+    launcher.input[0] = '\0';
+    launcher_match();
+    draw_monitor_bar(selected_monitor);
+}
+
+static void
+launcher_close(void)
+{
+    launcher.active = false;
+    XUngrabKeyboard(disp, CurrentTime);
+    draw_monitor_bar(selected_monitor);
+}
+
+// run the selected completion. input with arguments is handed to the shell as is.
+static void
+launcher_run(void)
+{
+    if (strchr(launcher.input, ' ')) {
+        const char* cmd[] = { "/bin/sh", "-c", launcher.input, NULL };
+        spawn((Arg) { .command = cmd });
+    } else if (launcher.nmatches > 0) {
+        const char* cmd[] = { exec_index.arena + launcher.matches[launcher.selected], NULL };
+        spawn((Arg) { .command = cmd });
+    } else if (launcher.len > 0) {
+        const char* cmd[] = { launcher.input, NULL };
+        spawn((Arg) { .command = cmd });
+    }
+}
+
+static void
+launcher_keypress(XKeyEvent* ev)
+{
+    char buf[32];
+    KeySym ks;
+    int n = XLookupString(ev, buf, sizeof(buf), &ks, NULL);
+
+    switch (ks) {
+    case XK_Escape:
+        launcher_close();
+        return;
+    case XK_Return:
+    case XK_KP_Enter:
+        launcher_run();
+        launcher_close();
+        return;
+    case XK_Tab:
+    case XK_Right:
+    case XK_Down:
+        if (launcher.nmatches > 0) {
+            launcher.selected = (launcher.selected + 1) % launcher.nmatches;
+        }
+        break;
+    case XK_ISO_Left_Tab:
+    case XK_Left:
+    case XK_Up:
+        if (launcher.nmatches > 0) {
+            launcher.selected = (launcher.selected + launcher.nmatches - 1) % launcher.nmatches;
+        }
+        break;
+    case XK_BackSpace:
+        if (launcher.len > 0) {
+            launcher.input[--launcher.len] = '\0';
+            launcher_match();
+        }
+        break;
+    default:
+        if (n > 0 && (unsigned char)buf[0] >= ' ' && !(ev->state & ControlMask)
+            && launcher.len + n < sizeof(launcher.input)) {
+            memcpy(launcher.input + launcher.len, buf, n);
+            launcher.len += n;
+            launcher.input[launcher.len] = '\0';
+            launcher_match();
+        }
+        break;
+    }
+
+    draw_monitor_bar(selected_monitor);
+}
+
+// the launcher takes over the bar of the selected monitor while it's open. returns
+// false if the bar should be drawn as usual.
+static bool
+launcher_shown(Monitor* m)
+{
+    return launcher.active && m == selected_monitor;
+}
+
+static bool
+draw_launcher(Monitor* m)
+{
+    if (!launcher_shown(m)) {
+        return false;
+    }
+
+    const int baseline = bar_height - (bar_height - font->ascent) / 2;
+    const int input_width = m->width / 4;
+    char prompt[sizeof(launcher.input) + 8];
+
+    XSetForeground(disp, m->graphics_ctx, unfocus_color);
+    XFillRectangle(disp, m->buffer, m->graphics_ctx, 0, 0, m->width, bar_height);
+
+    int n = snprintf(prompt, sizeof(prompt), "run: %s_", launcher.input);
+    XftDrawStringUtf8(m->xft, &xft_focus_color, font, 5, baseline, (XftChar8*)prompt, n);
+
+    int x = input_width;
+    for (int i = 0; i < launcher.nmatches && x < m->width; ++i) {
+        bool selected = i == launcher.selected;
+        x += draw_text(m, x, exec_index.arena + launcher.matches[i],
+            selected ? &xft_unfocus_color : &xft_focus_color, selected ? focus_color : unfocus_color);
+    }
+
+    return true;
+}
+#else
+// without the bar there's nothing to draw the launcher in, dmenu takes its place and
+// PATH doesn't need to be indexed.
+static int inotify_fd = -1;
+static struct {
+    bool active;
+} launcher;
+
+static void
+setup_exec_index(void)
+{
+}
+
+static void
+handle_inotify(void)
+{
+}
+
+static void
+launcher_keypress(XKeyEvent* ev)
+{
+    (void)ev;
+}
+
+static void
+launcher_open(void)
+{
+    spawn((Arg) { .command = dmenu_cmd });
+}
+#endif
+
+// clients on hidden workspaces are told so through WM_STATE and _NET_WM_STATE, so that
+// toolkits can stop rendering them. the properties are written in the commit, once for
+// everything a workspace switch changed, and only for clients whose state actually changed.
+static void
+set_wm_state(Client* cl, int state)
+{
+    long data[] = { state, None };
+
+    XChangeProperty(disp, cl->window, atoms[WMState], atoms[WMState], 32,
+        PropModeReplace, (unsigned char*)data, 2);
+    cl->wm_state = state;
+    write_net_wm_state(cl);
+}
+
+static void
+update_wm_states(void)
+{
+    for (int ws = 0; ws < WORKSPACE_TOTAL; ++ws) {
+        if (!workspaces[ws].state_dirty) {
+            continue;
+        }
+
+        bool shown = workspace_monitor(ws) != NULL;
+        for (Client* cl = workspaces[ws].first; cl != NULL; cl = cl->next) {
+            if (ws == SCRATCH_WS) {
+                shown = cl == scratch_active && scratch_visible;
+            }
+            int state = shown ? NormalState : IconicState;
+            if (cl->wm_state != state) {
+                set_wm_state(cl, state);
+            }
+        }
+        workspaces[ws].state_dirty = false;
+    }
+}
+
+static void
+commit(void)
+{
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (m->dirty) {
+            tile_monitor(m);
+            m->dirty = false;
+        }
+    }
+
+    bool focus_changed = focus_dirty;
+    if (focus_dirty) {
+        update_curr();
+        focus_dirty = false;
+    }
+    if (bars_dirty) {
+        draw_bar();
+        bars_dirty = false;
+    } else if (focus_changed) {
+        draw_titles();
+    }
+
+    update_wm_states();
+    ewmh_publish();
+    ipc_publish();
+    publish_state();
+    ++commit_count;
+    XFlush(disp);
+}
+
+static void
+start(void)
+{
+    XEvent event;
+    enum { PollX, PollSignal, PollInotify, PollFont, PollStatus, PollIpc, PollLast };
+    struct pollfd fds[PollLast + MAX_IPC_CLIENTS] = {
+        [PollX] = { .fd = ConnectionNumber(disp), .events = POLLIN },
+        [PollSignal] = { .fd = signal_fd, .events = POLLIN },
+        [PollInotify] = { .fd = inotify_fd, .events = POLLIN },
+        [PollFont] = { .fd = font_fd, .events = POLLIN },
+        [PollStatus] = { .fd = status_fd, .events = POLLIN },
+        [PollIpc] = { .fd = ipc_fd, .events = POLLIN },
+    };
+
+    while (!quit_flag) {
+        // handle everything xlib has already buffered before going to sleep, XPending
+        // also flushes our own requests to the server.
+        while (!quit_flag && XPending(disp)) {
+            XNextEvent(disp, &event);
+            ++event_counts[event.type];
+
+            // handle events we know how to handle
+            if (events[event.type]) {
+                events[event.type](&event);
+            }
+        }
+        if (quit_flag) {
+            break;
+        }
+        commit();
+
+        // commit can make round trips that read further events into xlib's queue, those
+        // are already off the socket and wouldn't wake poll.
+        int timeout = XQLength(disp) > 0 ? 0 : next_timeout();
+        int nipc = ipc_pollfds(fds + PollLast);
+        if (poll(fds, PollLast + nipc, timeout) < 0 && errno != EINTR) {
+            die("poll failed");
+        }
+        if (fds[PollSignal].revents & POLLIN) {
+            handle_signals();
+        }
+        if (fds[PollInotify].revents & POLLIN) {
+            handle_inotify();
+        }
+        if (fds[PollFont].revents & POLLIN) {
+            handle_font();
+            fds[PollFont].fd = -1;
+        }
+        if (fds[PollStatus].revents & POLLIN) {
+            handle_status();
+        }
+        if (fds[PollIpc].revents & POLLIN) {
+            ipc_accept();
+        }
+        ipc_handle(fds + PollLast, nipc);
+        run_timers();
+    }
+}
+
+static void
+client_to_workspace(const Arg arg)
+{
+    Client* cl = SEL_MONITOR_WS.curr;
+    if (arg.workspace_idx == selected_monitor->curr_workspace || cl == NULL)
+        return;
+
+    detach(cl, selected_monitor->curr_workspace);
+    attach(cl, arg.workspace_idx);
+    workspaces[arg.workspace_idx].curr = cl;
+    XUnmapWindow(disp, cl->window);
+
+    arrange(selected_monitor);
+}
+
+static void
+change_workspace(const Arg arg)
+{
+    // don't do anything if we're already in the correct workspace
+    if (arg.workspace_idx == selected_monitor->curr_workspace)
+        return;
+
+    // since the workspaces differ we want to unmap each window that is not currently
+    // in the workspace we're switching to. XUnmapWindow hides a given window untill it is
+    // brought back using the XMapWindow function
+    if (SEL_MONITOR_WS.first != NULL) {
+        // we have windows that we need to unwrap
+        for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
+            XUnmapWindow(disp, cl->window);
+        }
+    }
+
+    // the client lists live in workspaces[], switching only changes which one is shown.
+    SEL_MONITOR_WS.state_dirty = true;
+    selected_monitor->curr_workspace = arg.workspace_idx;
+    SEL_MONITOR_WS.state_dirty = true;
+
+    // map all of the windows that belong to the workspace that we switched to.
+    if (SEL_MONITOR_WS.first != NULL) {
+        // we have windows that we need to unwrap
+        for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
+            XMapWindow(disp, cl->window);
+        }
+    }
+
+    arrange(selected_monitor);
+    bars_dirty = true;
+}
+
+// add_window manages a new window and picks its workspace. shown is set to the monitor
+// showing that workspace, or NULL if it's hidden.
+static Client*
+add_window(Window w, Monitor** shown)
+{
+    Client* cl = create_client(w);
+    Client* parent = NULL;
+    Launch* l = NULL;
+    Monitor* m;
+    int ws;
+
+    probe_client(cl);
+    if (cl->transient_for) {
+        parent = find_client(cl->transient_for, &ws);
+    }
+    if (parent) {
+        // transients open next to their parent, wherever that is by now
+        m = workspace_monitor(ws);
+    } else if ((l = match_launch(w)) && l->ws != selected_monitor->curr_workspace) {
+        // windows of processes we launched go straight to the workspace they were
+        // launched from, even if that's no longer the one on screen.
+        ws = l->ws;
+        m = l->monitor->curr_workspace == ws ? l->monitor : workspace_monitor(ws);
+    } else {
+        m = monitor_from_window(w);
+        ws = m->curr_workspace;
+    }
+    if (m && !l && m != selected_monitor) {
+        focus_monitor(m);
+    }
+
+    attach(cl, ws);
+    workspaces[ws].curr = cl;
+    // pooled scratchpad terminals stay out of _NET_CLIENT_LIST until they're taken
+    if (ws != SCRATCH_WS) {
+        client_list_add(w);
+    }
+    if (cl->floating) {
+        place_floating(cl, m ? m : selected_monitor);
+    }
+
+    *shown = m;
+    return cl;
+}
+
+static void
+maprequest(XEvent* e)
+{
+    XMapRequestEvent* event = &e->xmaprequest;
+    int ws;
+
+    // clients on hidden workspaces stay unmapped until their workspace is shown
+    if (find_client(event->window, &ws)) {
+        if (workspace_monitor(ws)) {
+            XMapWindow(disp, event->window);
+        }
+        return;
+    }
+
+    if (add_dock(event->window)) {
+        XMapWindow(disp, event->window);
+        return;
+    }
+
+    Monitor* m;
+    Client* cl = add_window(event->window, &m);
+    if (m == NULL) {
+        // it went to a hidden workspace
+        return;
+    }
+    XMapWindow(disp, event->window);
+
+    // a dialog coming up doesn't move the tiled clients
+    if (cl->floating) {
+        focus_dirty = true;
+    } else {
+        arrange(m);
+    }
+}
+
+// spawn_on uses posix_spawn which doesn't copy our page tables like fork does. the
+// child gets its own session and a clean signal mask, the x connection is
+// close-on-exec. it also gets a startup id so that its windows can be matched to the
+// workspace they should be placed on.
+static void
+spawn_on(const char** command, int ws)
+{
+    static unsigned int launch_seq;
+    posix_spawnattr_t attr;
+    sigset_t empty, dfl;
+    pid_t pid;
+    char startup_id[48];
+    char startup_env[80];
+    size_t nenv = 0;
+
+    snprintf(startup_id, sizeof(startup_id), "stupidwm-%d-%u_TIME0", getpid(), ++launch_seq);
+    snprintf(startup_env, sizeof(startup_env), "DESKTOP_STARTUP_ID=%s", startup_id);
+
+    for (char** e = environ; *e; ++e) {
+        ++nenv;
+    }
+    char** envp = calloc(nenv + 2, sizeof(char*));
+    if (envp == NULL) {
+        die("failed calloc");
+    }
+    nenv = 0;
+    for (char** e = environ; *e; ++e) {
+        if (strncmp(*e, "DESKTOP_STARTUP_ID=", 19) != 0) {
+            envp[nenv++] = *e;
+        }
+    }
+    envp[nenv] = startup_env;
+
+    sigemptyset(&empty);
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGCHLD);
+    sigaddset(&dfl, SIGUSR1);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setsigdefault(&attr, &dfl);
+
+    int err = posix_spawnp(&pid, command[0], NULL, &attr, (char* const*)command, envp);
+    if (err != 0) {
+        fprintf(stdout, "stupidwm: failed to spawn %s: %s\n", command[0], strerror(err));
+    } else {
+        track_launch(pid, command[0], startup_id, ws);
+    }
+    posix_spawnattr_destroy(&attr);
+    free(envp);
+}
+
+static void
+spawn(const Arg arg)
+{
+    spawn_on(arg.command, selected_monitor->curr_workspace);
+}
+
+// the scratchpad keeps SCRATCH_POOL terminals managed but unmapped on SCRATCH_WS so that
+// one can be shown without waiting for the terminal to start. the shown terminal floats
+// above the current monitor and stays on SCRATCH_WS, the pool is refilled from the main
+// loop after one was taken.
+
+static void
+scratch_refill(void* _unused)
+{
+    (void)_unused;
+    if (quit_flag || shutdown_pending > 0) {
+        return;
+    }
+
+    int ready = 0;
+    for (Client* cl = workspaces[SCRATCH_WS].first; cl != NULL; cl = cl->next) {
+        if (cl != scratch_active) {
+            ++ready;
+        }
+    }
+    for (int i = 0; i < MAX_LAUNCHES; ++i) {
+        if (launches[i].pid != 0 && launches[i].ws == SCRATCH_WS && !launches[i].mapped) {
+            ++ready;
+        }
+    }
+
+    for (; ready < SCRATCH_POOL; ++ready) {
+        spawn_on(term_cmd, SCRATCH_WS);
+    }
+}
+
+static void
+scratch_show(Monitor* m)
+{
+    Client* cl = scratch_active;
+    const int width = m->width * 0.6;
+    const int height = m->height * 0.6;
+
+    resize(cl, m->x + (m->width - width) / 2, m->y + (m->height - height) / 2, width, height);
+    XSetWindowBorderWidth(disp, cl->window, 5);
+    XSetWindowBorder(disp, cl->window, focus_color);
+    XMapRaised(disp, cl->window);
+    XSetInputFocus(disp, cl->window, RevertToParent, CurrentTime);
+    scratch_visible = true;
+    workspaces[SCRATCH_WS].state_dirty = true;
+}
+
+static void
+scratch_toggle(void)
+{
+    if (scratch_active == NULL) {
+        // take the oldest terminal from the pool
+        Client* cl = workspaces[SCRATCH_WS].first;
+        if (cl == NULL) {
+            scratch_refill(NULL);
+            return;
+        }
+        scratch_active = cl;
+        client_list_add(cl->window);
+        add_timer(0, scratch_refill, &scratch_active);
+    } else if (scratch_visible) {
+        XUnmapWindow(disp, scratch_active->window);
+        scratch_visible = false;
+        workspaces[SCRATCH_WS].state_dirty = true;
+        focus_dirty = true;
+        return;
+    }
+
+    scratch_show(selected_monitor);
+}
+
+static void
+configurenotify(XEvent* e)
+{
+}
+
+// tiled clients don't get to pick their geometry. instead of configuring the window we
+// tell the client where it is with a synthetic ConfigureNotify, as ICCCM asks for, which
+// doesn't cause another relayout.
+static void
+send_configure(Client* cl)
+{
+    XConfigureEvent ce = {
+        .type = ConfigureNotify,
+        .display = disp,
+        .event = cl->window,
+        .window = cl->window,
+        .x = cl->x,
+        .y = cl->y,
+        .width = cl->width,
+        .height = cl->height,
+        .border_width = cl->fullscreen ? 0 : 5,
+        .above = None,
+        .override_redirect = False,
+    };
+    XSendEvent(disp, cl->window, False, StructureNotifyMask, (XEvent*)&ce);
+}
+
+static void
+configure_deferred(void* arg)
+{
+    Client* cl = arg;
+    cl->configure_deferred = false;
+    cl->configure_start = now_ms();
+    cl->configures = 1;
+    send_configure(cl);
+}
+
+static void
+configurerequest(XEvent* e)
+{
+    XConfigureRequestEvent* ev = &e->xconfigurerequest;
+    Client* cl = find_client(ev->window, NULL);
+
+    // clients that haven't been laid out yet, like the scratchpad pool, and floating
+    // clients may size themselves
+    if (cl && !cl->floating && cl->width > 0) {
+        // a client that keeps asking only gets an answer every so often, the requests
+        // in between are answered together once its second is over.
+        long long now = now_ms();
+        if (now - cl->configure_start >= 1000) {
+            cl->configure_start = now;
+            cl->configures = 0;
+        }
+        if (cl->configures < CONFIGURE_LIMIT) {
+            ++cl->configures;
+            send_configure(cl);
+        } else if (!cl->configure_deferred) {
+            cl->configure_deferred = true;
+            add_timer(cl->configure_start + 1000 - now, configure_deferred, cl);
+        }
+        return;
+    }
+
+    // floating and unmanaged windows get what they ask for
+    if (cl && cl->floating) {
+        cl->x = ev->value_mask & CWX ? ev->x : cl->x;
+        cl->y = ev->value_mask & CWY ? ev->y : cl->y;
+        cl->width = ev->value_mask & CWWidth ? ev->width : cl->width;
+        cl->height = ev->value_mask & CWHeight ? ev->height : cl->height;
+    }
+    XWindowChanges wc;
+    wc.x = ev->x;
+    wc.y = ev->y;
+    wc.width = ev->width;
+    wc.height = ev->height;
+    wc.border_width = ev->border_width;
+    wc.sibling = ev->above;
+    wc.stack_mode = ev->detail;
+    XConfigureWindow(disp, ev->window, ev->value_mask, &wc);
+}
+
+static void
+keypress(XEvent* e)
+{
+    XKeyEvent ev = e->xkey;
+    int ks_ret;
+
+    if (launcher.active) {
+        launcher_keypress(&e->xkey);
+        return;
+    }
+
+    KeySym* ks = XGetKeyboardMapping(disp, ev.keycode, 1, &ks_ret);
+
+    for (int i = 0; i < (sizeof(keys) / sizeof(*keys)); ++i) {
+        if (keys[i].ks == *ks && keys[i].mod == ev.state) {
+            keys[i].function(keys[i].arg);
+        }
+    }
+    XFree(ks);
+}
+
+static Monitor*
+monitor_from_coords(int x, int y)
+{
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (x >= m->x && x < m->x + m->width &&
+            y >= m->y && y < m->y + m->height)
+            return m;
+    }
+    return selected_monitor;
+}
+
+static void
+enternotify(XEvent* e)
+{
+    XEnterWindowEvent* ev = &e->xcrossing;
+
+    Monitor* m = monitor_from_coords(ev->x_root, ev->y_root);
+    focus_monitor(m);
+
+    // when the mouse hovers over the background we don't want to do anything
+    if (ev->window == rootwin) {
+        return;
+    }
+
+    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
+        if (cl->window == ev->window) {
+            SEL_MONITOR_WS.curr = cl;
+            focus_dirty = true;
+            break;
+        }
+    }
+}
+
+static void
+destroynotify(XEvent* e)
+{
+    XDestroyWindowEvent* dwe = &e->xdestroywindow;
+    int ws;
+
+    if (remove_dock(dwe->window)) {
+        return;
+    }
+
+    // the window might live on any workspace, not just the ones that are visible.
+    Client* cl = find_client(dwe->window, &ws);
+    if (cl == NULL) {
+        return;
+    }
+
+    bool floating = cl->floating;
+    detach(cl, ws);
+    cancel_timers(cl);
+    client_list_remove(cl->window);
+    if (cl == scratch_active) {
+        scratch_active = NULL;
+        scratch_visible = false;
+        add_timer(0, scratch_refill, &scratch_active);
+    }
+    free(cl);
+
+    if (shutdown_pending > 0 && --shutdown_pending == 0) {
+        cancel_timers(&shutdown_pending);
+        quit_flag = true;
+        return;
+    }
+
+    // neither does a dialog going away
+    if (floating) {
+        focus_dirty = true;
+    } else {
+        arrange(workspace_monitor(ws));
+    }
+}
+
+static void
+send_protocol(Window w, Atom protocol)
+{
+    XEvent ev = { .type = ClientMessage };
+    ev.xclient.window = w;
+    ev.xclient.message_type = atoms[WMProtocols];
+    ev.xclient.format = 32;
+    ev.xclient.data.l[0] = protocol;
+    ev.xclient.data.l[1] = CurrentTime;
+    ev.xclient.data.l[2] = w; // _NET_WM_PING expects the window here
+    XSendEvent(disp, w, False, NoEventMask, &ev);
+}
+
+// ask the client to close. clients that don't support WM_DELETE_WINDOW are
+// disconnected right away since they have no way of closing gracefully.
+static void
+close_client(Client* cl)
+{
+    if (cl->protocols & ProtoDelete) {
+        send_protocol(cl->window, atoms[WMDelete]);
+    } else {
+        XKillClient(disp, cl->window);
+    }
+}
+
+static void
+kill_deadline(void* arg)
+{
+    Client* cl = arg;
+
+    // the client still responds, it's most likely asking the user something so leave
+    // it be. the timer is cancelled if the client goes away in time.
+    if (KILL_PING && cl->alive) {
+        return;
+    }
+    XKillClient(disp, cl->window);
+}
+
+static void
+kill_curr(void)
+{
+    Client* cl = focused_client();
+    if (cl == NULL) {
+        return;
+    }
+
+    close_client(cl);
+    if (!(cl->protocols & ProtoDelete)) {
+        return;
+    }
+
+    cl->alive = false;
+    if (KILL_PING && (cl->protocols & ProtoPing)) {
+        send_protocol(cl->window, atoms[NetWMPing]);
+    }
+    cancel_timers(cl);
+    cl->configure_deferred = false;
+    cl->title_pending = false;
+    add_timer(KILL_TIMEOUT_MS, kill_deadline, cl);
+}
+
+// tiled clients get their tile back from the next layout, floating clients aren't laid
+// out and are moved back by hand.
+static void
+leave_fullscreen(Client* cl)
+{
+    cl->fullscreen = false;
+    XSetWindowBorderWidth(disp, cl->window, 5);
+    if (cl->floating && cl->float_width > 0) {
+        resize(cl, cl->float_x, cl->float_y, cl->float_width, cl->float_height);
+    }
+}
+
+static void
+set_fullscreen(Client* cl, int ws, bool fullscreen)
+{
+    if (cl->fullscreen == fullscreen) {
+        return;
+    }
+
+    Client* prev = workspaces[ws].fullscreen;
+    if (fullscreen && prev) {
+        leave_fullscreen(prev);
+        write_net_wm_state(prev);
+    }
+
+    if (fullscreen) {
+        cl->fullscreen = true;
+        if (cl->floating) {
+            cl->float_x = cl->x;
+            cl->float_y = cl->y;
+            cl->float_width = cl->width;
+            cl->float_height = cl->height;
+        }
+    } else {
+        leave_fullscreen(cl);
+    }
+    workspaces[ws].fullscreen = fullscreen ? cl : NULL;
+    write_net_wm_state(cl);
+    arrange(workspace_monitor(ws));
+}
+
+static void
+clientmessage(XEvent* e)
+{
+    XClientMessageEvent* ev = &e->xclient;
+
+    // ping replies are sent back to the root window with the client window in l[2]
+    if (ev->window == rootwin && ev->message_type == atoms[WMProtocols]
+        && (Atom)ev->data.l[0] == atoms[NetWMPing]) {
+        Client* cl = find_client(ev->data.l[2], NULL);
+        if (cl) {
+            cl->alive = true;
+        }
+    } else if (ev->message_type == atoms[NetWMState]) {
+        int ws;
+        Client* cl = find_client(ev->window, &ws);
+        if (cl == NULL || ws == SCRATCH_WS
+            || (ev->data.l[1] != (long)atoms[NetWMStateFullscreen]
+                && ev->data.l[2] != (long)atoms[NetWMStateFullscreen])) {
+            return;
+        }
+
+        // 0 removes the state, 1 adds it and 2 toggles it
+        bool fullscreen = ev->data.l[0] == 2 ? !cl->fullscreen : ev->data.l[0] == 1;
+        set_fullscreen(cl, ws, fullscreen);
+    } else if (ev->message_type == atoms[NetCurrentDesktop]) {
+        // pagers and xdotool switching the desktop
+        if (ev->data.l[0] >= 0 && ev->data.l[0] < WORKSPACE_COUNT) {
+            change_workspace((Arg) { .workspace_idx = ev->data.l[0] });
+        }
+    } else if (ev->message_type == atoms[NetActiveWindow]) {
+        // rofi's window mode and friends activating a window, possibly on a hidden workspace
+        int ws;
+        Client* cl = find_client(ev->window, &ws);
+        if (cl == NULL || ws == SCRATCH_WS) {
+            return;
+        }
+
+        Monitor* m = workspace_monitor(ws);
+        if (m) {
+            focus_monitor(m);
+        } else {
+            change_workspace((Arg) { .workspace_idx = ws });
+        }
+        workspaces[ws].curr = cl;
+        focus_dirty = true;
+    }
+}
+
+// read the client's title, preferring the utf-8 _NET_WM_NAME over WM_NAME.
+static void
+update_name(Client* cl)
+{
+    XTextProperty prop;
+    char** list = NULL;
+    int n;
+
+    cl->has_name = true;
+    cl->name[0] = '\0';
+    if (!XGetTextProperty(disp, cl->window, &prop, atoms[NetWMName]) || !prop.nitems) {
+        if (!XGetTextProperty(disp, cl->window, &prop, XA_WM_NAME) || !prop.nitems) {
+            return;
+        }
+    }
+
+    if (prop.encoding == XA_STRING || prop.encoding == atoms[UTF8String]) {
+        snprintf(cl->name, sizeof(cl->name), "%.*s", (int)prop.nitems, (char*)prop.value);
+    } else if (XmbTextPropertyToTextList(disp, &prop, &list, &n) >= Success && n > 0 && *list) {
+        snprintf(cl->name, sizeof(cl->name), "%s", *list);
+        XFreeStringList(list);
+    }
+    XFree(prop.value);
+
+    // titles are sent line by line over ipc
+    for (char* c = cl->name; *c; ++c) {
+        if (*c == '\n' || *c == '\r') {
+            *c = ' ';
+        }
+    }
+}
+
+// titles are read on first use, so clients restored on restart are never queried up front.
+static const char*
+client_name(Client* cl)
+{
+    if (!cl->has_name) {
+        update_name(cl);
+    }
+    return cl->name;
+}
+
+#ifndef NOBAR
+// a terminal showing build output can retitle itself hundreds of times a second, the bar
+// only follows at most every TITLE_INTERVAL_MS.
+static void
+title_timer(void* arg)
+{
+    Monitor* m = arg;
+    m->title_pending = false;
+    m->title_drawn = now_ms();
+    draw_title(m);
+}
+
+static void
+schedule_title(Monitor* m)
+{
+    if (m->title_pending) {
+        return;
+    }
+
+    long long delay = m->title_drawn + TITLE_INTERVAL_MS - now_ms();
+    m->title_pending = true;
+    add_timer(delay > 0 ? delay : 0, title_timer, m);
+}
+#endif
+
+// ipc subscribers get the same rate limit as the bar, the title is only read once the
+// event is sent.
+static void
+title_event(void* arg)
+{
+    Client* cl = arg;
+    cl->title_pending = false;
+    cl->title_sent = now_ms();
+    ipc_event("title 0x%lx %s", cl->window, client_name(cl));
+}
+
+static void
+schedule_title_event(Client* cl)
+{
+    if (cl->title_pending) {
+        return;
+    }
+
+    long long delay = cl->title_sent + TITLE_INTERVAL_MS - now_ms();
+    cl->title_pending = true;
+    add_timer(delay > 0 ? delay : 0, title_event, cl);
+}
+
+static void
+propertynotify(XEvent* e)
+{
+    XPropertyEvent* ev = &e->xproperty;
+    if (ev->atom == atoms[NetWMStrut] || ev->atom == atoms[NetWMStrutPartial]) {
+        Dock* d = find_dock(ev->window);
+        if (d) {
+            update_dock(d);
+        }
+        return;
+    }
+    if (ev->state == PropertyDelete || (ev->atom != XA_WM_NAME && ev->atom != atoms[NetWMName])) {
+        return;
+    }
+
+    Client* cl = find_client(ev->window, NULL);
+    if (cl == NULL) {
+        return;
+    }
+    cl->has_name = false;
+    schedule_title_event(cl);
+#ifndef NOBAR
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (workspaces[m->curr_workspace].curr == cl) {
+            schedule_title(m);
+        }
+    }
+#endif
+}
+
+static void
+setup_keybinds(void)
+{
+    for (int i = 0; i < (sizeof(keys) / sizeof(*keys)); ++i) {
+        KeySym ks = XKeysymToKeycode(disp, keys[i].ks);
+        if (ks) {
+            XGrabKey(disp, ks, keys[i].mod, rootwin, 1, GrabModeAsync, GrabModeAsync);
+        }
+    }
+}
+
+// forcefully disconnect every client that is still around and stop the main loop.
+static void
+finish_shutdown(void* _unused)
+{
+    (void)_unused;
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        for (Client* cl = workspaces[i].first; cl != NULL; cl = cl->next) {
+            XKillClient(disp, cl->window);
+        }
+    }
+
+    quit_flag = true;
+}
+
+// quitting asks every managed client to close and then waits for their DestroyNotify
+// events in the main loop. clients that are still around after QUIT_TIMEOUT_MS, or when
+// quit is requested a second time, are killed.
+static void
+quit()
+{
+    if (shutdown_pending > 0) {
+        cancel_timers(&shutdown_pending);
+        finish_shutdown(NULL);
+        return;
+    }
+
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        for (Client* cl = workspaces[i].first; cl != NULL; cl = cl->next) {
+            close_client(cl);
+            ++shutdown_pending;
+        }
+    }
+
+    if (shutdown_pending == 0) {
+        quit_flag = true;
+        return;
+    }
+
+    add_timer(QUIT_TIMEOUT_MS, finish_shutdown, &shutdown_pending);
+}
+
+static void
+swap_curr_with_master()
+{
+    if (SEL_MONITOR_WS.first != NULL && SEL_MONITOR_WS.curr != SEL_MONITOR_WS.first && SEL_MONITOR_WS.curr != NULL) {
+        // the nodes trade places in the list, everything we know about a client stays
+        // with its window.
+        Client* master = SEL_MONITOR_WS.first;
+        Client* cl = SEL_MONITOR_WS.curr;
+        Client* prev = cl->prev;
+        Client* next = cl->next;
+
+        if (prev == master) {
+            master->next = next;
+            master->prev = cl;
+            cl->next = master;
+        } else {
+            cl->next = master->next;
+            cl->next->prev = cl;
+            master->prev = prev;
+            master->next = next;
+            prev->next = master;
+        }
+        if (next) {
+            next->prev = master;
+        }
+        cl->prev = NULL;
+        SEL_MONITOR_WS.first = cl;
+        journal_log(JournalSwap, cl->window, master->window);
+
+        arrange(selected_monitor);
+    }
+}
+
+static Monitor*
+create_monitor(int x, int y, int width, int height, bool primary)
+{
+    Monitor* m = calloc(1, sizeof(Monitor));
+    if (!m) {
+        die("failed to allocate monitor");
+    }
+
+    // init properties
+    m->x = x;
+    m->y = y;
+    m->width = width;
+    m->height = height;
+    m->primary = primary;
+    m->curr_workspace = 0;
+    m->published_ws = -1;
+    m->next = NULL;
+    update_workarea(m);
+
+#ifndef NOBAR
+    XSetWindowAttributes wa = {
+        .override_redirect = 1,
+        .background_pixel = unfocus_color,
+        .event_mask = ExposureMask,
+    };
+
+    m->bar_window = XCreateWindow(disp, rootwin,
+        x, y, width, bar_height, 0,
+        DefaultDepth(disp, main_screen),
+        CopyFromParent, DefaultVisual(disp, main_screen),
+        CWOverrideRedirect | CWBackPixel | CWEventMask, &wa);
+
+    m->buffer = XCreatePixmap(disp, m->bar_window, width, bar_height, DefaultDepth(disp, main_screen));
+    m->graphics_ctx = XCreateGC(disp, m->bar_window, 0, NULL);
+    m->xft = XftDrawCreate(disp, m->buffer, XDefaultVisual(disp, main_screen), XDefaultColormap(disp, main_screen));
+    if (!m->xft) {
+        die("failed to create xft draw context for monitor");
+    }
+
+    XMapWindow(disp, m->bar_window);
+#endif
+    return m;
+}
+
+static void
+setup_monitors(void)
+{
+
+    monitors = NULL;
+    selected_monitor = NULL;
+
+    int num_monitors;
+    XRRScreenResources* res = XRRGetScreenResources(disp, rootwin);
+    XRROutputInfo* output_info;
+    XRRCrtcInfo* crtc_info;
+
+    printf("number of outputs: %d\n", res->noutput);
+
+    for (int i = 0; i < res->noutput; i++) {
+        output_info = XRRGetOutputInfo(disp, res, res->outputs[i]);
+
+        if (output_info->connection == RR_Connected && output_info->crtc) {
+            crtc_info = XRRGetCrtcInfo(disp, res, output_info->crtc);
+
+            Monitor* m = create_monitor(
+                crtc_info->x,
+                crtc_info->y,
+                crtc_info->width,
+                crtc_info->height,
+                i == 0);
+
+            if (!monitors) {
+                monitors = m;
+                selected_monitor = m;
+            } else {
+                Monitor* last;
+                for (last = monitors; last->next; last = last->next)
+                    ;
+                last->next = m;
+            }
+
+            XRRFreeCrtcInfo(crtc_info);
+        }
+        XRRFreeOutputInfo(output_info);
+    }
+
+    XRRFreeScreenResources(res);
+
+    if (!monitors) {
+        monitors = create_monitor(0, 0, selected_monitor->width, selected_monitor->height, true);
+        selected_monitor = monitors;
+    }
+}
+
+static void
+setup_atoms(void)
+{
+    if (!XInternAtoms(disp, atom_names, AtomLast, False, atoms)) {
+        die("failed to intern atoms");
+    }
+}
+
+// windows can disappear between the moment we learn about them and the moment we
+// act on them, for example while adopting windows on startup. those errors are
+// expected and shouldn't take the whole wm down.
+static int
+xerror(Display* d, XErrorEvent* ee)
+{
+    if (ee->error_code == BadWindow
+        || (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch)
+        || (ee->request_code == X_SetInputFocus && ee->error_code == BadMatch)
+        || (ee->request_code == X_GetProperty && ee->error_code == BadAtom)) {
+        return 0;
+    }
+
+    return xerrorxlib(d, ee);
+}
+
+static void
+adopt(Window w, int ws, bool* adopted)
+{
+    Client* cl = create_client(w);
+    probe_client(cl);
+    attach(cl, ws);
+    workspaces[ws].curr = cl;
+    if (ws != SCRATCH_WS) {
+        client_list_add(w);
+    }
+    adopted[ws] = true;
+}
+
+// adopt the windows that already exist when we start, for example after the wm was
+// restarted or crashed. the tree is queried once and the clients are only laid out
+// after all of them have been attached, so each visible workspace is tiled exactly
+// once. windows that are already managed, i.e. restored from a snapshot, are left
+// untouched. windows known to the journal are put back in their journaled order.
+static void
+scan(void)
 {
-    Client* tmp = SEL_MONITOR_WS.curr;
-    int tmp2 = arg.workspace_idx;
+    Window root_return, parent;
+    Window* children = NULL;
+    unsigned int nchildren;
+    bool adopted[WORKSPACE_TOTAL] = { false };
 
-    if (arg.workspace_idx == selected_monitor->curr_workspace || SEL_MONITOR_WS.curr == NULL)
+    if (!XQueryTree(disp, rootwin, &root_return, &parent, &children, &nchildren)) {
         return;
+    }
+
+    // the workspace for each child or -1 if it shouldn't be managed
+    int* target = calloc(nchildren ? nchildren : 1, sizeof(int));
+    if (target == NULL) {
+        die("failed calloc");
+    }
+
+    for (unsigned int i = 0; i < nchildren; ++i) {
+        XWindowAttributes wa;
+        target[i] = -1;
+        if (find_client(children[i], NULL)) {
+            continue;
+        }
+        if (!XGetWindowAttributes(disp, children[i], &wa) || wa.override_redirect) {
+            continue;
+        }
+        if (wa.map_state == IsViewable && add_dock(children[i])) {
+            continue;
+        }
+
+        // windows on hidden workspaces were unmapped by the previous instance, those are
+        // recognised by the journal or the workspace hint we left on them.
+        int ws = journal_lookup(children[i]);
+        if (ws < 0) {
+            ws = get_workspace_hint(children[i]);
+        }
+        if (wa.map_state != IsViewable && ws < 0) {
+            continue;
+        }
+        target[i] = ws < 0 ? selected_monitor->curr_workspace : ws;
+    }
+
+    for (int j = 0; j < journal_nstate; ++j) {
+        for (unsigned int i = 0; i < nchildren; ++i) {
+            if (children[i] == journal_state[j].window && target[i] >= 0) {
+                adopt(children[i], target[i], adopted);
+                target[i] = -1;
+                break;
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < nchildren; ++i) {
+        if (target[i] >= 0) {
+            adopt(children[i], target[i], adopted);
+        }
+    }
+
+    free(target);
+    if (children) {
+        XFree(children);
+    }
+
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        if (!adopted[i]) {
+            continue;
+        }
+
+        Monitor* m = workspace_monitor(i);
+        for (Client* cl = workspaces[i].first; cl != NULL; cl = cl->next) {
+            if (m) {
+                XMapWindow(disp, cl->window);
+            } else {
+                XUnmapWindow(disp, cl->window);
+            }
+        }
+
+        arrange(m);
+    }
+}
+
+#define SNAPSHOT_MAGIC   0x34574d53 // "SWM4"
+#define SNAPSHOT_NOFOCUS UINT32_MAX
+
+// the state handed over to the new process on restart. the header is followed by the
+// workspace of each monitor and then by a SnapshotClient for every client of every
+// workspace in list order.
+typedef struct {
+    uint32_t magic;
+    uint32_t nmonitors;
+    uint32_t selected_monitor;
+    uint32_t nclients[WORKSPACE_TOTAL];
+    uint32_t curr[WORKSPACE_TOTAL]; // index of the focused client or SNAPSHOT_NOFOCUS
+    uint32_t scratch; // the scratchpad terminal taken from the pool or 0
+    uint32_t scratch_visible;
+} Snapshot;
+
+enum {
+    SnapshotFullscreen = 1 << 0,
+    SnapshotFloating = 1 << 1,
+};
+
+typedef struct {
+    uint32_t window;
+    uint32_t protocols;
+    uint32_t flags;
+    uint32_t transient_for;
+    int32_t x, y, width, height;
+} SnapshotClient;
+
+// serialise the whole wm state into an anonymous memory file. the fd is intentionally
+// not close-on-exec so that it survives the exec into the new binary.
+static int
+write_snapshot(void)
+{
+    Snapshot hdr = {
+        .magic = SNAPSHOT_MAGIC,
+        .scratch = scratch_active ? scratch_active->window : 0,
+        .scratch_visible = scratch_visible,
+    };
+    size_t nclients = 0;
+
+    for (Monitor* m = monitors; m; m = m->next) {
+        if (m == selected_monitor) {
+            hdr.selected_monitor = hdr.nmonitors;
+        }
+        ++hdr.nmonitors;
+    }
+
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        hdr.curr[i] = SNAPSHOT_NOFOCUS;
+        for (Client* cl = workspaces[i].first; cl != NULL; cl = cl->next) {
+            if (cl == workspaces[i].curr) {
+                hdr.curr[i] = hdr.nclients[i];
+            }
+            ++hdr.nclients[i];
+        }
+        nclients += hdr.nclients[i];
+    }
+
+    size_t size = sizeof(hdr) + hdr.nmonitors * sizeof(uint32_t) + nclients * sizeof(SnapshotClient);
+    unsigned char* buf = malloc(size);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    uint32_t* out = (uint32_t*)(buf + sizeof(hdr));
+    for (Monitor* m = monitors; m; m = m->next) {
+        *out++ = m->curr_workspace;
+    }
+    SnapshotClient* sc = (SnapshotClient*)out;
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        for (Client* cl = workspaces[i].first; cl != NULL; cl = cl->next) {
+            // a fullscreen client is laid out again anyway, a floating one keeps the place
+            // it goes back to instead
+            bool saved = cl->fullscreen && cl->floating && cl->float_width > 0;
+            *sc++ = (SnapshotClient) {
+                .window = cl->window,
+                .protocols = cl->protocols,
+                .flags = (cl->fullscreen ? SnapshotFullscreen : 0) | (cl->floating ? SnapshotFloating : 0),
+                .transient_for = cl->transient_for,
+                .x = saved ? cl->float_x : cl->x,
+                .y = saved ? cl->float_y : cl->y,
+                .width = saved ? cl->float_width : cl->width,
+                .height = saved ? cl->float_height : cl->height,
+            };
+        }
+    }
+
+    int fd = memfd_create("stupidwm-state", 0);
+    if (fd >= 0 && write(fd, buf, size) != (ssize_t)size) {
+        close(fd);
+        fd = -1;
+    }
+
+    free(buf);
+    return fd;
+}
+
+// rebuild the workspaces from a snapshot written by write_snapshot. the windows are
+// trusted as they are, nothing is queried from the server. returns false if the
+// snapshot is unusable in which case the state is left empty.
+static bool
+restore_snapshot(int fd)
+{
+    struct stat st;
+    bool ok = false;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Snapshot)) {
+        close(fd);
+        return false;
+    }
+
+    unsigned char* buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED) {
+        return false;
+    }
+
+    Snapshot hdr;
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    size_t expected = sizeof(hdr) + hdr.nmonitors * sizeof(uint32_t);
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        expected += hdr.nclients[i] * sizeof(SnapshotClient);
+    }
+    if (hdr.magic != SNAPSHOT_MAGIC || expected != (size_t)st.st_size) {
+        goto out;
+    }
+
+    const uint32_t* in = (const uint32_t*)(buf + sizeof(hdr));
+    uint32_t idx = 0;
+    for (Monitor* m = monitors; m; m = m->next, ++idx) {
+        // the monitor layout may have changed in between, extra monitors keep their default
+        if (idx < hdr.nmonitors && in[idx] < WORKSPACE_COUNT) {
+            m->curr_workspace = in[idx];
+        }
+        if (idx == hdr.selected_monitor) {
+            selected_monitor = m;
+        }
+    }
+    in += hdr.nmonitors;
+
+    SnapshotClient sc;
+    const unsigned char* next = (const unsigned char*)in;
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        for (uint32_t j = 0; j < hdr.nclients[i]; ++j) {
+            memcpy(&sc, next, sizeof(sc));
+            next += sizeof(sc);
+
+            Client* cl = create_client(sc.window);
+            cl->protocols = sc.protocols;
+            cl->fullscreen = sc.flags & SnapshotFullscreen;
+            cl->floating = sc.flags & SnapshotFloating;
+            cl->transient_for = sc.transient_for;
+            cl->x = sc.x;
+            cl->y = sc.y;
+            cl->width = sc.width;
+            cl->height = sc.height;
+            if (cl->floating) {
+                cl->float_x = sc.x;
+                cl->float_y = sc.y;
+                cl->float_width = sc.width;
+                cl->float_height = sc.height;
+            }
+            attach(cl, i);
+            if (i != SCRATCH_WS || sc.window == hdr.scratch) {
+                client_list_add(sc.window);
+            }
+            if (j == hdr.curr[i]) {
+                workspaces[i].curr = cl;
+            }
+            if (i == SCRATCH_WS && cl->window == hdr.scratch) {
+                scratch_active = cl;
+                scratch_visible = hdr.scratch_visible;
+            }
+        }
+    }
+    ok = true;
 
-    update_global(arg.workspace_idx);
-    add_window(tmp->window);
-    save_state(arg.workspace_idx);
+out:
+    munmap(buf, st.st_size);
+    return ok;
+}
 
-    update_global(tmp2);
-    remove_window(SEL_MONITOR_WS.curr->window);
+// replace the running process with a fresh copy of the binary without losing any
+// state. the clients are never unmapped so nothing moves on screen.
+static void
+restart(void)
+{
+    int fd = write_snapshot();
+    if (fd < 0) {
+        fprintf(stdout, "stupidwm: failed to write state snapshot\n");
+        return;
+    }
 
-    tile_screen();
-    update_curr();
+    char fdarg[16];
+    snprintf(fdarg, sizeof(fdarg), "%d", fd);
+    char* argv[] = { wm_path, "--restore-fd", fdarg, NULL };
+
+    fprintf(stdout, "stupidwm: restarting\n");
+    fflush(stdout);
+    // the display connection is close-on-exec, it's kept open so that a failed exec,
+    // e.g. while the binary is being rebuilt, leaves the session running.
+    XSync(disp, False);
+    execvp(wm_path, argv);
+    fprintf(stdout, "stupidwm: failed to restart: %s\n", strerror(errno));
+    close(fd);
 }
 
+// a connection on the ipc socket. every line it sends is one command, all commands
+// that arrive together are applied before the next commit so that a script moving a
+// dozen windows causes a single relayout. a connection that subscribes gets state
+// changes pushed to it as numbered events instead of having to poll.
+typedef struct {
+    int fd; // -1 if the slot is unused
+    size_t len;
+    char in[IPC_BUF_SIZE];
+    bool subscribed;
+    bool overflow; // events were dropped, a snapshot is sent once the queue drains
+    size_t outlen;
+    char out[IPC_OUT_SIZE];
+} IpcConn;
+
+static IpcConn ipc_conns[MAX_IPC_CLIENTS];
+static unsigned long ipc_seq; // sequence number of the last event
+static Window published_focus;
+
 static void
-change_workspace(const Arg arg)
+setup_ipc(void)
 {
-    // don't do anything if we're already in the correct workspace
-    if (arg.workspace_idx == selected_monitor->curr_workspace)
-        return;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
 
-    // since the workspaces differ we want to unmap each window that is not currently
-    // in the workspace we're switching to. XUnmapWindow hides a given window untill it is
-    // brought back using the XMapWindow function
-    if (SEL_MONITOR_WS.first != NULL) {
-        // we have windows that we need to unwrap
-        for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
-            XUnmapWindow(disp, cl->window);
-        }
+    for (int i = 0; i < MAX_IPC_CLIENTS; ++i) {
+        ipc_conns[i].fd = -1;
     }
 
-    // we need to save the state that the workspace is in such that when we switch back
-    // between workspaces the position of the windows stays the same.
-    save_state(selected_monitor->curr_workspace);
-    update_global(arg.workspace_idx); // update the global state with the current workspace
-
-    // map all of the windows that belong to the workspace that we switched to.
-    if (SEL_MONITOR_WS.first != NULL) {
-        // we have windows that we need to unwrap
-        for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
-            XMapWindow(disp, cl->window);
-        }
+    if (!runtime_path(addr.sun_path, sizeof(addr.sun_path), "sock")) {
+        return;
+    }
+    ipc_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ipc_fd < 0) {
+        return;
     }
 
-    tile_screen();
-    update_curr();
-    draw_bar();
+    unlink(addr.sun_path);
+    if (bind(ipc_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(ipc_fd, MAX_IPC_CLIENTS) < 0) {
+        fprintf(stdout, "stupidwm: failed to listen on %s\n", addr.sun_path);
+        close(ipc_fd);
+        ipc_fd = -1;
+    }
 }
 
 static void
-maprequest(XEvent* e)
+cleanup_ipc(void)
 {
-    XMapRequestEvent* event = &e->xmaprequest;
-    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
-        if (event->window == cl->window) {
-            XMapWindow(disp, event->window);
-            return;
+    struct sockaddr_un addr;
+
+    for (int i = 0; i < MAX_IPC_CLIENTS; ++i) {
+        if (ipc_conns[i].fd >= 0) {
+            close(ipc_conns[i].fd);
+        }
+    }
+    if (ipc_fd >= 0) {
+        close(ipc_fd);
+        if (runtime_path(addr.sun_path, sizeof(addr.sun_path), "sock")) {
+            unlink(addr.sun_path);
         }
     }
-
-    add_window(event->window);
-    XMapWindow(disp, event->window);
-    tile_screen();
-    update_curr();
 }
 
 static void
-spawn(const Arg arg)
+ipc_accept(void)
 {
-    if (fork() == 0) {
-        if (fork() == 0) {
-            if (disp) {
-                close(ConnectionNumber(disp));
-            }
-            setsid();
-            execvp((char*)arg.command[0], (char**)arg.command);
+    int fd = accept4(ipc_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    for (int i = 0; i < MAX_IPC_CLIENTS; ++i) {
+        if (ipc_conns[i].fd < 0) {
+            ipc_conns[i] = (IpcConn) { .fd = fd };
+            return;
         }
-        exit(0);
     }
+    close(fd);
 }
 
 static void
-configurenotify(XEvent* e)
+ipc_close(IpcConn* c)
 {
+    close(c->fd);
+    c->fd = -1;
+    c->subscribed = false;
 }
 
-static void
-configurerequest(XEvent* e)
+// queue output for the connection. returns false if it doesn't fit.
+static bool
+ipc_queue(IpcConn* c, const char* buf, size_t len)
 {
-    // handle window conf requests i.e. resize of move from different applications
-    // here we just do what the request wants since we will be changing the state
-    // later to be tiled (or follow whatever window composition schema)
-    XConfigureRequestEvent* ev = &e->xconfigurerequest;
-    XWindowChanges wc;
-    wc.x = ev->x;
-    wc.y = ev->y;
-    wc.width = ev->width;
-    wc.height = ev->height;
-    wc.border_width = ev->border_width;
-    wc.sibling = ev->above;
-    wc.stack_mode = ev->detail;
-    XConfigureWindow(disp, ev->window, ev->value_mask, &wc);
+    if (c->outlen + len > sizeof(c->out)) {
+        return false;
+    }
+    memcpy(c->out + c->outlen, buf, len);
+    c->outlen += len;
+    return true;
 }
 
+static void ipc_snapshot(IpcConn* c, const char* kind);
+
+// write as much of the queued output as the socket takes without blocking.
 static void
-keypress(XEvent* e)
+ipc_flush(IpcConn* c)
 {
-    XKeyEvent ev = e->xkey;
-    int ks_ret;
-    KeySym* ks = XGetKeyboardMapping(disp, ev.keycode, 1, &ks_ret);
-
-    for (int i = 0; i < (sizeof(keys) / sizeof(*keys)); ++i) {
-        if (keys[i].ks == *ks && keys[i].mod == ev.state) {
-            keys[i].function(keys[i].arg);
+    while (c->outlen > 0) {
+        ssize_t n = send(c->fd, c->out, c->outlen, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                ipc_close(c);
+            }
+            return;
         }
+        c->outlen -= n;
+        memmove(c->out, c->out + n, c->outlen);
     }
-}
 
-static Monitor*
-monitor_from_coords(int x, int y)
-{
-    for (Monitor* m = monitors; m; m = m->next) {
-        if (x >= m->x && x < m->x + m->width &&
-            y >= m->y && y < m->y + m->height)
-            return m;
+    // the subscriber has caught up, hand it the current state in place of the events
+    // it missed.
+    if (c->overflow) {
+        c->overflow = false;
+        ipc_snapshot(c, "resync");
     }
-    return selected_monitor;
 }
 
 static void
-enternotify(XEvent* e)
+ipc_event(const char* fmt, ...)
 {
-    XEnterWindowEvent* ev = &e->xcrossing;
-
-    Monitor* m = monitor_from_coords(ev->x_root, ev->y_root);
-    focus_monitor(m);
+    char buf[512];
+    va_list ap;
+    bool any = false;
 
-    // when the mouse hovers over the background we don't want to do anything
-    if (ev->window == rootwin) {
+    for (int i = 0; i < MAX_IPC_CLIENTS && !any; ++i) {
+        any = ipc_conns[i].fd >= 0 && ipc_conns[i].subscribed;
+    }
+    if (!any) {
         return;
     }
 
-    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
-        if (cl->window == ev->window) {
-            SEL_MONITOR_WS.curr = cl;
-            update_curr();
-            break;
+    int n = snprintf(buf, sizeof(buf), "%lu ", ++ipc_seq);
+    va_start(ap, fmt);
+    n += vsnprintf(buf + n, sizeof(buf) - n - 1, fmt, ap);
+    va_end(ap);
+    n = n < (int)sizeof(buf) - 1 ? n : (int)sizeof(buf) - 2;
+    buf[n++] = '\n';
+
+    for (int i = 0; i < MAX_IPC_CLIENTS; ++i) {
+        IpcConn* c = &ipc_conns[i];
+        if (c->fd < 0 || !c->subscribed || c->overflow) {
+            continue;
+        }
+        // a slow subscriber never blocks us, it just gets a snapshot later on
+        if (!ipc_queue(c, buf, n)) {
+            c->overflow = true;
         }
     }
 }
 
+// the complete state as one block of lines, framed by "<kind> begin/end <seq>".
 static void
-destroynotify(XEvent* e)
+ipc_snapshot(IpcConn* c, const char* kind)
 {
-    XDestroyWindowEvent* dwe = &e->xdestroywindow;
-    bool found_window = false;
+    char buf[512];
+    int n, idx = 0;
+    bool ok;
 
-    // ensure that the window actually exists. this might not be necessary but nice to check
-    // that we don't do anything unexpected if the window isn't managed.
-    for (Client* cl = SEL_MONITOR_WS.first; cl != NULL; cl = cl->next) {
-        if (dwe->window == cl->window) {
-            found_window = true;
-            break;
-        }
+    n = snprintf(buf, sizeof(buf), "%s begin %lu\n", kind, ipc_seq);
+    ok = ipc_queue(c, buf, n);
+
+    for (Monitor* m = monitors; m && ok; m = m->next, ++idx) {
+        n = snprintf(buf, sizeof(buf), "monitor %d %d %d %d %d %d%s\n", idx, m->x, m->y,
+            m->width, m->height, m->curr_workspace, m == selected_monitor ? " selected" : "");
+        ok = ipc_queue(c, buf, n);
     }
-    if (!found_window) {
-        return;
+    for (int i = 0; i < WORKSPACE_TOTAL && ok; ++i) {
+        for (Client* cl = workspaces[i].first; cl && ok; cl = cl->next) {
+            n = snprintf(buf, sizeof(buf), "client 0x%lx %d %s\n", cl->window, i, client_name(cl));
+            ok = ipc_queue(c, buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+        }
     }
 
-    remove_window(dwe->window);
-    tile_screen();
-    update_curr();
+    Client* focus = focused_client();
+    n = snprintf(buf, sizeof(buf), "focus 0x%lx\n%s end %lu\n", focus ? focus->window : 0, kind, ipc_seq);
+    if (!ok || !ipc_queue(c, buf, n)) {
+        // try again once the subscriber has drained its queue
+        c->overflow = true;
+    }
 }
 
+// announce what changed during this commit and push the queued events out. monitors
+// are only read once at startup and configurenotify ignores RandR changes, so there is
+// no monitor event, subscribers learn the layout from the snapshot.
 static void
-send_kill_signal(Window w)
+ipc_publish(void)
 {
-    XEvent ke;
-    ke.type = ClientMessage;
-    ke.xclient.window = w;
-    ke.xclient.message_type = XInternAtom(disp, "WM_PROTOCOLS", 1);
-    ke.xclient.format = 32;
-    ke.xclient.data.l[0] = XInternAtom(disp, "WM_DELETE_WINDOW", 1);
-    ke.xclient.data.l[1] = CurrentTime;
-    XSendEvent(disp, w, False, NoEventMask, &ke);
-}
+    int idx = 0;
+    for (Monitor* m = monitors; m; m = m->next, ++idx) {
+        if (m->published_ws != m->curr_workspace) {
+            m->published_ws = m->curr_workspace;
+            ipc_event("workspace %d %d", idx, m->curr_workspace);
+        }
+    }
 
-static void
-kill_curr(void)
-{
-    if (SEL_MONITOR_WS.curr != NULL) {
-        XEvent ke;
-        ke.type = ClientMessage;
-        ke.xclient.window = SEL_MONITOR_WS.curr->window;
-        ke.xclient.message_type = XInternAtom(disp, "WM_PROTOCOLS", True);
-        ke.xclient.format = 32;
-        ke.xclient.data.l[0] = XInternAtom(disp, "WM_DELETE_WINDOW", True);
-        ke.xclient.data.l[1] = CurrentTime;
-        XSendEvent(disp, SEL_MONITOR_WS.curr->window, 0, NoEventMask, &ke);
-        send_kill_signal(SEL_MONITOR_WS.curr->window);
+    Client* focus = focused_client();
+    Window w = focus ? focus->window : None;
+    if (w != published_focus) {
+        published_focus = w;
+        ipc_event("focus 0x%lx", w);
+    }
+
+    for (int i = 0; i < MAX_IPC_CLIENTS; ++i) {
+        if (ipc_conns[i].fd >= 0 && ipc_conns[i].outlen > 0) {
+            ipc_flush(&ipc_conns[i]);
+        }
     }
 }
 
-static void
-setup_keybinds(void)
+static bool
+parse_workspace(const char* arg, int* ws)
 {
-    for (int i = 0; i < (sizeof(keys) / sizeof(*keys)); ++i) {
-        KeySym ks = XKeysymToKeycode(disp, keys[i].ks);
-        if (ks) {
-            XGrabKey(disp, ks, keys[i].mod, rootwin, 1, GrabModeAsync, GrabModeAsync);
-        }
+    char* end;
+    long n = arg ? strtol(arg, &end, 10) : -1;
+    if (arg == NULL || *end != '\0' || n < 0 || n >= WORKSPACE_COUNT) {
+        return false;
     }
+    *ws = n;
+    return true;
 }
 
-static void
-quit()
+// run a single command. returns NULL on success or a description of what went wrong.
+static const char*
+ipc_command(IpcConn* c, char* line)
 {
-    if (quit_flag) {
-        cleanup_font();
-        XUngrabKey(disp, AnyKey, AnyModifier, rootwin);
-        XDestroySubwindows(disp, rootwin);
-        fprintf(stdout, "stupidwm: quitting...");
-        XCloseDisplay(disp);
-        die("shutdown");
+    char* argv[32];
+    int argc = 0;
+    char* save;
+    int ws;
+
+    for (char* tok = strtok_r(line, " \t", &save); tok && argc < 31; tok = strtok_r(NULL, " \t", &save)) {
+        argv[argc++] = tok;
     }
+    argv[argc] = NULL;
 
-    Window root_return, parent;
-    Window* children;
-    int i;
-    unsigned int nchildren;
-    XEvent ev;
-    quit_flag = 1;
-    XQueryTree(disp, rootwin, &root_return, &parent, &children, &nchildren);
-    for (i = 0; i < nchildren; i++) {
-        send_kill_signal(children[i]);
+    if (argc == 0) {
+        return "empty command";
     }
 
-    while (nchildren > 0) {
-        XQueryTree(disp, rootwin, &root_return, &parent, &children, &nchildren);
-        XNextEvent(disp, &ev);
-        if (events[ev.type])
-            events[ev.type](&ev);
+    const char* cmd = argv[0];
+    if (strcmp(cmd, "subscribe") == 0) {
+        // the connection only receives events from now on
+        c->subscribed = true;
+        if (argc > 1 && strcmp(argv[1], "snapshot") == 0) {
+            ipc_snapshot(c, "snapshot");
+        }
+    } else if (strcmp(cmd, "workspace") == 0) {
+        if (!parse_workspace(argv[1], &ws)) {
+            return "usage: workspace <0-9>";
+        }
+        change_workspace((Arg) { .workspace_idx = ws });
+    } else if (strcmp(cmd, "send") == 0) {
+        if (!parse_workspace(argv[1], &ws)) {
+            return "usage: send <0-9>";
+        }
+        client_to_workspace((Arg) { .workspace_idx = ws });
+    } else if (strcmp(cmd, "focus") == 0) {
+        const char* dir = argc > 1 ? argv[1] : "";
+        if (strcmp(dir, "left") == 0) {
+            move_left();
+        } else if (strcmp(dir, "right") == 0) {
+            move_right();
+        } else if (strcmp(dir, "up") == 0) {
+            move_up();
+        } else if (strcmp(dir, "down") == 0) {
+            move_down();
+        } else if (strcmp(dir, "monitor") == 0) {
+            focus_next_monitor();
+        } else {
+            return "usage: focus <left|right|up|down|monitor>";
+        }
+    } else if (strcmp(cmd, "swap") == 0) {
+        swap_curr_with_master();
+    } else if (strcmp(cmd, "layout") == 0) {
+        for (Monitor* m = monitors; m; m = m->next) {
+            arrange(m);
+        }
+    } else if (strcmp(cmd, "kill") == 0) {
+        kill_curr();
+    } else if (strcmp(cmd, "spawn") == 0) {
+        if (argc < 2) {
+            return "usage: spawn <command> [args...]";
+        }
+        spawn((Arg) { .command = (const char**)&argv[1] });
+    } else if (strcmp(cmd, "scratchpad") == 0) {
+        scratch_toggle();
+    } else if (strcmp(cmd, "launcher") == 0) {
+        launcher_open();
+    } else if (strcmp(cmd, "restart") == 0) {
+        restart();
+    } else if (strcmp(cmd, "quit") == 0) {
+        quit();
+    } else {
+        return "unknown command";
     }
 
-    XUngrabKey(disp, AnyKey, AnyModifier, rootwin);
-    fprintf(stdout, "stupidwm: quitting\n");
+    return NULL;
 }
 
+// run every complete line in the connection's buffer and send back one reply line per
+// command. incomplete lines are kept until the rest arrives.
 static void
-swap_curr_with_master()
+ipc_run(IpcConn* c)
 {
-    if (SEL_MONITOR_WS.first != NULL && SEL_MONITOR_WS.curr != SEL_MONITOR_WS.first && SEL_MONITOR_WS.curr != NULL) {
-        Window tmp = SEL_MONITOR_WS.first->window;
-        SEL_MONITOR_WS.first->window = SEL_MONITOR_WS.curr->window;
-        SEL_MONITOR_WS.curr->window = tmp;
-        SEL_MONITOR_WS.curr = SEL_MONITOR_WS.first;
+    char* start = c->in;
+    char* nl;
 
-        tile_screen();
-        update_curr();
+    while ((nl = memchr(start, '\n', c->len - (start - c->in)))) {
+        char reply[128];
+
+        *nl = '\0';
+        const char* err = ipc_command(c, start);
+        start = nl + 1;
+
+        // subscribers only get events, replies would break the stream
+        if (!c->subscribed) {
+            int n = err ? snprintf(reply, sizeof(reply), "error: %s\n", err) : snprintf(reply, sizeof(reply), "ok\n");
+            ipc_queue(c, reply, n);
+        }
     }
+
+    c->len -= start - c->in;
+    memmove(c->in, start, c->len);
+    ipc_flush(c);
 }
 
-static Monitor*
-create_monitor(int x, int y, int width, int height, bool primary)
+static int
+ipc_pollfds(struct pollfd* fds)
 {
-    Monitor* m = calloc(1, sizeof(Monitor));
-    if (!m) {
-        die("failed to allocate monitor");
+    int n = 0;
+    for (int i = 0; i < MAX_IPC_CLIENTS; ++i) {
+        if (ipc_conns[i].fd >= 0) {
+            short events = POLLIN | (ipc_conns[i].outlen > 0 ? POLLOUT : 0);
+            fds[n++] = (struct pollfd) { .fd = ipc_conns[i].fd, .events = events };
+        }
     }
+    return n;
+}
 
-    // init properties
-    m->x = x;
-    m->y = y;
-    m->width = width;
-    m->height = height;
-    m->primary = primary;
-    m->curr_workspace = 0;
-    m->next = NULL;
+static void
+ipc_handle(struct pollfd* fds, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        if (!fds[i].revents) {
+            continue;
+        }
 
-    XSetWindowAttributes wa = {
-        .override_redirect = 1,
-        .background_pixel = unfocus_color,
-        .event_mask = ExposureMask,
-    };
+        IpcConn* c = NULL;
+        for (int j = 0; j < MAX_IPC_CLIENTS && c == NULL; ++j) {
+            if (ipc_conns[j].fd == fds[i].fd) {
+                c = &ipc_conns[j];
+            }
+        }
+        if (c == NULL) {
+            continue;
+        }
 
-    m->bar_window = XCreateWindow(disp, rootwin,
-        x, y, width, bar_height, 0,
-        DefaultDepth(disp, main_screen),
-        CopyFromParent, DefaultVisual(disp, main_screen),
-        CWOverrideRedirect | CWBackPixel | CWEventMask, &wa);
+        if (fds[i].revents & POLLOUT) {
+            ipc_flush(c);
+            if (c->fd < 0) {
+                continue;
+            }
+        }
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
 
-    m->graphics_ctx = XCreateGC(disp, m->bar_window, 0, NULL);
-    m->xft = XftDrawCreate(disp, m->bar_window, XDefaultVisual(disp, main_screen), XDefaultColormap(disp, main_screen));
-    if (!m->xft) {
-        die("failed to create xft draw context for monitor");
+        ssize_t r = read(c->fd, c->in + c->len, sizeof(c->in) - c->len);
+        if (r <= 0) {
+            if (r == 0 || (errno != EAGAIN && errno != EINTR)) {
+                ipc_close(c);
+            }
+            continue;
+        }
+
+        c->len += r;
+        ipc_run(c);
+        if (c->len == sizeof(c->in)) {
+            // a single line longer than the whole buffer, there's no way to recover
+            ipc_close(c);
+        }
     }
+}
 
-    XMapWindow(disp, m->bar_window);
-    return m;
+// the state mirror is a file in XDG_RUNTIME_DIR that external tools mmap to read the
+// state without a round trip to us. it's rewritten at the end of every commit under a
+// seqlock, see stupidwm.h.
+static State* state;
+
+static void
+setup_state(void)
+{
+    char path[512];
+
+    if (!runtime_path(path, sizeof(path), "state")) {
+        return;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (ftruncate(fd, sizeof(State)) < 0) {
+        close(fd);
+        return;
+    }
+
+    state = mmap(NULL, sizeof(State), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (state == MAP_FAILED) {
+        state = NULL;
+        return;
+    }
+
+    // keep the sequence going so a reader spanning a restart never sees it go backwards
+    uint32_t seq = atomic_load_explicit(&state->seq, memory_order_relaxed);
+    atomic_store_explicit(&state->seq, (seq + 1) | 1, memory_order_relaxed);
+    state->magic = STATE_MAGIC;
+    state->version = STATE_VERSION;
+    atomic_store_explicit(&state->seq, (seq + 2) & ~1u, memory_order_release);
 }
 
 static void
-setup_monitors(void)
+publish_state(void)
 {
+    if (!state) {
+        return;
+    }
 
-    monitors = NULL;
-    selected_monitor = NULL;
+    uint32_t seq = atomic_load_explicit(&state->seq, memory_order_relaxed);
+    atomic_store_explicit(&state->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 
-    int num_monitors;
-    XRRScreenResources* res = XRRGetScreenResources(disp, rootwin);
-    XRROutputInfo* output_info;
-    XRRCrtcInfo* crtc_info;
+    uint32_t n = 0;
+    for (Monitor* m = monitors; m && n < STATE_MAX_MONITORS; m = m->next, ++n) {
+        if (m == selected_monitor) {
+            state->selected_monitor = n;
+        }
+        state->monitors[n] = (StateMonitor) { m->x, m->y, m->width, m->height, m->curr_workspace };
+    }
+    state->nmonitors = n;
+
+    Client* focus = focused_client();
+    n = 0;
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
+        bool visible = workspace_monitor(i) != NULL;
+        for (Client* cl = workspaces[i].first; cl != NULL && n < STATE_MAX_CLIENTS; cl = cl->next) {
+            uint32_t flags = (cl == focus ? StateFocused : 0)
+                | (visible || (cl == scratch_active && scratch_visible) ? StateVisible : 0);
+            state->clients[n++] = (StateClient) { cl->window, i, cl->x, cl->y, cl->width, cl->height, flags };
+        }
+    }
+    state->nclients = n;
+    state->focus = focus ? focus->window : 0;
+    state->commits = commit_count;
+    for (int i = 0; i < LASTEvent && i < STATE_EVENT_TYPES; ++i) {
+        state->events[i] = event_counts[i];
+    }
 
-    printf("number of outputs: %d\n", res->noutput);
+    atomic_store_explicit(&state->seq, seq + 2, memory_order_release);
+}
 
-    for (int i = 0; i < res->noutput; i++) {
-        output_info = XRRGetOutputInfo(disp, res, res->outputs[i]);
+static void
+cleanup_state(void)
+{
+    char path[512];
 
-        if (output_info->connection == RR_Connected && output_info->crtc) {
-            crtc_info = XRRGetCrtcInfo(disp, res, output_info->crtc);
+    if (!state) {
+        return;
+    }
+    munmap(state, sizeof(State));
+    state = NULL;
+    if (runtime_path(path, sizeof(path), "state")) {
+        unlink(path);
+    }
+}
 
-            Monitor* m = create_monitor(
-                crtc_info->x,
-                crtc_info->y,
-                crtc_info->width,
-                crtc_info->height,
-                i == 0);
+// the EWMH root properties are updated once per commit and only when their value has
+// changed, so tools like pagers can rely on them without us rewriting everything on every
+// focus change.
+static Window wm_check;
+static Window published_active = ~0ul;
+static long published_desktop = -1;
 
-            if (!monitors) {
-                monitors = m;
-                selected_monitor = m;
-            } else {
-                Monitor* last;
-                for (last = monitors; last->next; last = last->next)
-                    ;
-                last->next = m;
-            }
+static void
+setup_ewmh(void)
+{
+    Atom supported[] = {
+        atoms[NetSupported], atoms[NetSupportingWMCheck], atoms[NetClientList],
+        atoms[NetActiveWindow], atoms[NetCurrentDesktop], atoms[NetNumberOfDesktops],
+        atoms[NetWMName], atoms[NetWMPing], atoms[NetWMPid], atoms[NetWMState],
+        atoms[NetWMStateHidden], atoms[NetWMStateFullscreen], atoms[NetWMWindowType],
+        atoms[NetWMWindowTypeDialog], atoms[NetWMWindowTypeUtility], atoms[NetWMWindowTypeSplash],
+        atoms[NetWMWindowTypeDock], atoms[NetWMStrut], atoms[NetWMStrutPartial],
+    };
+    long ndesktops = WORKSPACE_COUNT;
+
+    wm_check = XCreateSimpleWindow(disp, rootwin, 0, 0, 1, 1, 0, 0, 0);
+    XChangeProperty(disp, wm_check, atoms[NetSupportingWMCheck], XA_WINDOW, 32,
+        PropModeReplace, (unsigned char*)&wm_check, 1);
+    XChangeProperty(disp, wm_check, atoms[NetWMName], atoms[UTF8String], 8,
+        PropModeReplace, (unsigned char*)"stupidwm", 8);
+    XChangeProperty(disp, rootwin, atoms[NetSupportingWMCheck], XA_WINDOW, 32,
+        PropModeReplace, (unsigned char*)&wm_check, 1);
+    XChangeProperty(disp, rootwin, atoms[NetSupported], XA_ATOM, 32,
+        PropModeReplace, (unsigned char*)supported, sizeof(supported) / sizeof(*supported));
+    XChangeProperty(disp, rootwin, atoms[NetNumberOfDesktops], XA_CARDINAL, 32,
+        PropModeReplace, (unsigned char*)&ndesktops, 1);
+}
 
-            XRRFreeCrtcInfo(crtc_info);
-        }
-        XRRFreeOutputInfo(output_info);
+static void
+ewmh_publish(void)
+{
+    if (client_list_rewrite) {
+        XChangeProperty(disp, rootwin, atoms[NetClientList], XA_WINDOW, 32,
+            PropModeReplace, (unsigned char*)client_list, nclient_list);
+        client_list_rewrite = false;
+        client_list_published = nclient_list;
+    } else if (nclient_list > client_list_published) {
+        XChangeProperty(disp, rootwin, atoms[NetClientList], XA_WINDOW, 32,
+            PropModeAppend, (unsigned char*)(client_list + client_list_published),
+            nclient_list - client_list_published);
+        client_list_published = nclient_list;
     }
 
-    XRRFreeScreenResources(res);
+    Client* focus = focused_client();
+    Window active = focus ? focus->window : None;
+    if (active != published_active) {
+        XChangeProperty(disp, rootwin, atoms[NetActiveWindow], XA_WINDOW, 32,
+            PropModeReplace, (unsigned char*)&active, 1);
+        published_active = active;
+    }
 
-    if (!monitors) {
-        monitors = create_monitor(0, 0, selected_monitor->width, selected_monitor->height, true);
-        selected_monitor = monitors;
+    long desktop = selected_monitor->curr_workspace;
+    if (desktop != published_desktop) {
+        XChangeProperty(disp, rootwin, atoms[NetCurrentDesktop], XA_CARDINAL, 32,
+            PropModeReplace, (unsigned char*)&desktop, 1);
+        published_desktop = desktop;
     }
 }
 
+static void
+cleanup_ewmh(void)
+{
+    XDeleteProperty(disp, rootwin, atoms[NetActiveWindow]);
+    XDeleteProperty(disp, rootwin, atoms[NetClientList]);
+    XDeleteProperty(disp, rootwin, atoms[NetSupportingWMCheck]);
+    XDestroyWindow(disp, wm_check);
+}
+
 int
 main(int argc, char* argv[])
 {
+    int restore_fd = -1;
+    wm_path = argv[0];
+    if (argc == 3 && strcmp(argv[1], "--restore-fd") == 0) {
+        restore_fd = atoi(argv[2]);
+    }
+
     disp = XOpenDisplay(NULL);
     if (disp == NULL) {
         die("cannot open display");
     }
 
     // setup signal for child processes
-    sigchld(0);
+    setup_signals();
+
+    // spawned processes must not inherit the x connection
+    fcntl(ConnectionNumber(disp), F_SETFD, FD_CLOEXEC);
 
     main_screen = XDefaultScreen(disp);
     rootwin = XRootWindow(disp, main_screen);
 
     quit_flag = false;
+    setup_atoms();
 
     cursor = XCreateFontCursor(disp, XC_left_ptr);
     XDefineCursor(disp, rootwin, cursor);
@@ -904,20 +4626,42 @@ main(int argc, char* argv[])
     setup_monitors();
     setup_keybinds();
     setup_bar();
+    setup_status();
+    setup_exec_index();
+    setup_ipc();
+    setup_state();
+    setup_ewmh();
 
-    for (int i = 0; i < WORKSPACE_COUNT; ++i) {
+    for (int i = 0; i < WORKSPACE_TOTAL; ++i) {
         workspaces[i].first = NULL;
         workspaces[i].curr = NULL;
     }
 
     // make xorg send window management events to us.
     XSelectInput(disp, rootwin, SubstructureNotifyMask | SubstructureRedirectMask);
+    XSync(disp, False);
+    xerrorxlib = XSetErrorHandler(xerror);
 
-    draw_bar();
+    journal_open();
+    if (restore_fd >= 0 && !restore_snapshot(restore_fd)) {
+        fprintf(stdout, "stupidwm: ignoring invalid state snapshot\n");
+    }
+    scan();
+    journal_compact();
+    scratch_refill(NULL);
+    focus_dirty = true;
+    bars_dirty = true;
 
     // start listening for XEvents
     start();
+    fprintf(stdout, "stupidwm: quitting\n");
+    journal_close();
+    cleanup_ipc();
+    cleanup_state();
+    cleanup_ewmh();
 
+    cleanup_font();
+    XUngrabKey(disp, AnyKey, AnyModifier, rootwin);
     XFreeCursor(disp, cursor);
     XCloseDisplay(disp);
     return 0;
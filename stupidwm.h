@@ -0,0 +1,57 @@
+#ifndef STUPIDWM_H
+#define STUPIDWM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// layout of the state mirror stupidwm publishes in $XDG_RUNTIME_DIR/stupidwm-<display>.state.
+// readers mmap the file and copy the state out under the seqlock:
+//
+//     do {
+//         s1 = atomic_load_explicit(&st->seq, memory_order_acquire);
+//         copy = *st;
+//         atomic_thread_fence(memory_order_acquire);
+//         s2 = atomic_load_explicit(&st->seq, memory_order_relaxed);
+//     } while (s1 & 1 || s1 != s2);
+
+#define STATE_MAGIC        0x54534d53 // "SMST"
+#define STATE_VERSION      1
+#define STATE_MAX_MONITORS 8
+#define STATE_MAX_CLIENTS  256
+#define STATE_EVENT_TYPES  64 // indexed by the x event type
+
+enum {
+    StateFocused = 1 << 0,
+    StateVisible = 1 << 1,
+};
+
+typedef struct {
+    int32_t x, y;
+    int32_t width, height;
+    int32_t workspace;
+} StateMonitor;
+
+typedef struct {
+    uint32_t window;
+    int32_t workspace;
+    int32_t x, y;
+    int32_t width, height;
+    uint32_t flags;
+} StateClient;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t seq; // odd while the wm is writing
+    uint32_t selected_monitor;
+    uint32_t nmonitors;
+    uint32_t nclients;
+    uint32_t focus; // focused window or 0
+    uint32_t pad;
+    uint64_t commits;
+    uint64_t events[STATE_EVENT_TYPES];
+    StateMonitor monitors[STATE_MAX_MONITORS];
+    StateClient clients[STATE_MAX_CLIENTS];
+} State;
+
+#endif